@@ -0,0 +1,91 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "batch.h"
+#include "utils.h"
+
+/* Number of consecutive underused polls after which the adaptive batch
+   shrinks. */
+#define DILL_BATCH_SHRINK 16
+
+static int dill_batch_resize(struct dill_batch *self, int size) {
+    if(self->elemsz) {
+        void *evs = realloc(self->evs, self->elemsz * size);
+        if(dill_slow(!evs)) {errno = ENOMEM; return -1;}
+        self->evs = evs;
+    }
+    self->size = size;
+    self->underused = 0;
+    return 0;
+}
+
+int dill_batch_init(struct dill_batch *self, size_t elemsz) {
+    self->evs = NULL;
+    self->elemsz = elemsz;
+    self->adaptive = 0;
+    self->polls = 0;
+    self->events = 0;
+    self->fullpolls = 0;
+    return dill_batch_resize(self, DILL_BATCH_DEFAULT);
+}
+
+void dill_batch_term(struct dill_batch *self) {
+    free(self->evs);
+    self->evs = NULL;
+}
+
+int dill_batch_set(struct dill_batch *self, int size) {
+    if(dill_slow(size < 0 || size > DILL_BATCH_MAX)) {
+        errno = EINVAL; return -1;}
+    if(size == 0) {
+        self->adaptive = 1;
+        return 0;
+    }
+    int rc = dill_batch_resize(self, size);
+    if(dill_slow(rc < 0)) return -1;
+    self->adaptive = 0;
+    return 0;
+}
+
+void dill_batch_done(struct dill_batch *self, int numevs) {
+    dill_batch_count(self, numevs);
+    if(numevs >= self->size) {
+        ++self->fullpolls;
+        self->underused = 0;
+        /* If the memory can't be allocated stay with the current size. */
+        if(self->adaptive && self->size < DILL_BATCH_MAX)
+            dill_batch_resize(self, self->size * 2);
+        return;
+    }
+    if(!self->adaptive) return;
+    if(numevs >= self->size / 4 || self->size <= DILL_BATCH_MIN) {
+        self->underused = 0;
+        return;
+    }
+    if(++self->underused >= DILL_BATCH_SHRINK)
+        dill_batch_resize(self, self->size / 2);
+}
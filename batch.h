@@ -0,0 +1,75 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef DILL_BATCH_INCLUDED
+#define DILL_BATCH_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of events harvested by a single poll, unless set otherwise. */
+#define DILL_BATCH_DEFAULT 128
+/* Limits for the adaptive mode. */
+#define DILL_BATCH_MIN 16
+#define DILL_BATCH_MAX 65536
+
+/* Buffer for events harvested by a single poll. The size is either fixed or,
+   in adaptive mode, it doubles each time a poll fills the whole buffer and
+   halves when the polls keep using only a small part of it. */
+struct dill_batch {
+    /* The buffer itself. NULL if the pollset doesn't need one. */
+    void *evs;
+    size_t elemsz;
+    /* Number of events that fit into the buffer. */
+    int size;
+    /* 1 if the size is adjusted automatically. */
+    int adaptive;
+    /* Number of consecutive polls that used less than a quarter of the
+       buffer. */
+    int underused;
+    /* Statistics. */
+    uint64_t polls;
+    uint64_t events;
+    uint64_t fullpolls;
+};
+
+/* 'elemsz' is the size of a single event. If it is 0 no buffer is
+   allocated. */
+int dill_batch_init(struct dill_batch *self, size_t elemsz);
+void dill_batch_term(struct dill_batch *self);
+
+/* Sets the size of the batch. 0 switches to the adaptive mode. */
+int dill_batch_set(struct dill_batch *self, int size);
+
+/* Records the number of events harvested by a poll. */
+static inline void dill_batch_count(struct dill_batch *self, int numevs) {
+    ++self->polls;
+    self->events += numevs;
+}
+
+/* Records the number of events harvested by a poll that used the buffer.
+   In adaptive mode, it may resize the buffer for the next poll. */
+void dill_batch_done(struct dill_batch *self, int numevs);
+
+#endif
@@ -22,14 +22,17 @@
 
 */
 
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "chmt.h"
 #include "cr.h"
 #include "libdill.h"
 #include "list.h"
+#include "now.h"
 #include "utils.h"
 
 struct dill_chan {
@@ -41,6 +44,13 @@ struct dill_chan {
     struct dill_list in;
     /* List of clauses wanting to send to the channel. */
     struct dill_list out;
+    /* Ring buffer of 'cap' items, each 'sz' bytes long. 'first' is the index
+       of the oldest item in the buffer, 'items' is the number of items
+       currently stored. Unbuffered channels have 'cap' set to zero. */
+    char *buf;
+    size_t cap;
+    size_t first;
+    size_t items;
     /* 1 if chdone() was already called. 0 otherwise. */
     unsigned int done : 1;
     /* 1 if the object was created via chmake_mem() function. */
@@ -50,7 +60,23 @@ struct dill_chan {
 /* Channel clause. */
 struct dill_chcl {
     struct dill_clause cl;
+    /* Array of items to send or space for items to receive. */
     void *val;
+    /* Size of the array, in items. Once the clause is triggered, the number
+       of items actually passed. */
+    size_t n;
+};
+
+/* Clauses of a blocked send or receive. */
+struct dill_chwait {
+    struct dill_chcl chcl;
+    struct dill_tmcl tmcl;
+};
+
+/* Clauses of a blocked operation on a cross-thread channel. */
+struct dill_chmtwait {
+    struct dill_chmt_waiter w;
+    struct dill_tmcl tmcl;
 };
 
 DILL_CT_ASSERT(sizeof(struct chmem) >= sizeof(struct dill_chan));
@@ -68,8 +94,11 @@ static void dill_chan_close(struct hvfs *vfs);
 /*  Channel creation and deallocation.                                        */
 /******************************************************************************/
 
-int chmake_mem(size_t itemsz, struct chmem *mem) {
+int chmake_buf_mem(size_t itemsz, size_t capacity, struct chmem *mem,
+      void *buf) {
     if(dill_slow(!mem)) {errno = EINVAL; return -1;}
+    if(dill_slow(capacity > 0 && itemsz > 0 && !buf)) {
+        errno = EINVAL; return -1;}
     /* Return ECANCELED if the coroutine is shutting down. */
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
@@ -79,16 +108,25 @@ int chmake_mem(size_t itemsz, struct chmem *mem) {
     ch->sz = itemsz;
     dill_list_init(&ch->in);
     dill_list_init(&ch->out);
+    ch->buf = buf;
+    ch->cap = capacity;
+    ch->first = 0;
+    ch->items = 0;
     ch->done = 0;
     ch->mem = 1;
     /* Allocate a handle to point to the channel. */
     return hmake(&ch->vfs);
 }
 
-int chmake(size_t itemsz) {
-    struct dill_chan *ch = malloc(sizeof(struct dill_chan));
+int chmake_buf(size_t itemsz, size_t capacity) {
+    /* The buffer is allocated in the same chunk of memory as the channel. */
+    if(dill_slow(itemsz > 0 &&
+          capacity > (SIZE_MAX - sizeof(struct dill_chan)) / itemsz)) {
+        errno = EINVAL; return -1;}
+    struct dill_chan *ch = malloc(sizeof(struct dill_chan) +
+        itemsz * capacity);
     if(dill_slow(!ch)) {errno = ENOMEM; return -1;}
-    int h = chmake_mem(itemsz, (struct chmem*)ch);
+    int h = chmake_buf_mem(itemsz, capacity, (struct chmem*)ch, ch + 1);
     if(dill_slow(h < 0)) {
         int err = errno;
         free(ch);
@@ -99,6 +137,18 @@ int chmake(size_t itemsz) {
     return h;
 }
 
+int chmake_mem(size_t itemsz, struct chmem *mem) {
+    return chmake_buf_mem(itemsz, 0, mem, NULL);
+}
+
+int chmake(size_t itemsz) {
+    return chmake_buf(itemsz, 0);
+}
+
+int chmake_ptr(void) {
+    return chmake_buf(sizeof(struct chptr), 0);
+}
+
 static void *dill_chan_query(struct hvfs *vfs, const void *type) {
     if(dill_fast(type == dill_chan_type)) return vfs;
     errno = ENOTSUP;
@@ -127,75 +177,344 @@ static void dill_chan_close(struct hvfs *vfs) {
 /*  Sending and receiving.                                                    */
 /******************************************************************************/
 
-int chsend(int h, const void *val, size_t len, int64_t deadline) {
+/* Stores as many items as fit into the buffer. Returns the number of items
+   stored. */
+static size_t dill_chan_store(struct dill_chan *ch, const char *vals,
+      size_t n) {
+    size_t i;
+    for(i = 0; i != n && ch->items < ch->cap; ++i) {
+        size_t pos = ch->first + ch->items;
+        if(pos >= ch->cap) pos -= ch->cap;
+        memcpy(ch->buf + pos * ch->sz, vals + i * ch->sz, ch->sz);
+        ++ch->items;
+    }
+    return i;
+}
+
+/* Sends as many items as possible without blocking. Each waiting receiver
+   gets as many items as it has space for. Returns the number of items
+   sent. */
+static size_t dill_chan_sendmany(struct dill_chan *ch, const char *vals,
+      size_t n) {
+    size_t i = 0;
+    /* Copy the items directly to the waiting receivers. If there are any
+       the buffer is necessarily empty. */
+    while(i != n && !dill_list_empty(&ch->in)) {
+        struct dill_chcl *chcl = dill_cont(dill_list_next(&ch->in),
+            struct dill_chcl, cl.epitem);
+        size_t m = chcl->n < n - i ? chcl->n : n - i;
+        memcpy(dill_craddr(chcl->cl.cr, chcl->val), vals + i * ch->sz,
+            m * ch->sz);
+        chcl->n = m;
+        dill_trigger(&chcl->cl, 0);
+        i += m;
+    }
+    /* Store the rest in the buffer. */
+    return i + dill_chan_store(ch, vals + i * ch->sz, n - i);
+}
+
+/* Receives as many items as possible without blocking. Each waiting sender
+   gives away as many items as there is space for. Returns the number of
+   items received. */
+static size_t dill_chan_recvmany(struct dill_chan *ch, char *vals, size_t n) {
+    size_t i = 0;
+    /* Take the oldest items from the buffer. */
+    while(i != n && ch->items > 0) {
+        memcpy(vals + i * ch->sz, ch->buf + ch->first * ch->sz, ch->sz);
+        ++ch->first;
+        if(ch->first == ch->cap) ch->first = 0;
+        --ch->items;
+        ++i;
+    }
+    /* Once the buffer is empty copy the items directly from the waiting
+       senders. Whatever the last sender has left over goes to the
+       buffer. */
+    while(i != n && !dill_list_empty(&ch->out)) {
+        struct dill_chcl *chcl = dill_cont(dill_list_next(&ch->out),
+            struct dill_chcl, cl.epitem);
+        const char *src = dill_craddr(chcl->cl.cr, chcl->val);
+        size_t m = chcl->n < n - i ? chcl->n : n - i;
+        memcpy(vals + i * ch->sz, src, m * ch->sz);
+        chcl->n = m + dill_chan_store(ch, src + m * ch->sz, chcl->n - m);
+        dill_trigger(&chcl->cl, 0);
+        i += m;
+    }
+    /* Slots were freed. If there are senders waiting, move their items
+       into the buffer and let them go. */
+    while(ch->items < ch->cap && !dill_list_empty(&ch->out)) {
+        struct dill_chcl *chcl = dill_cont(dill_list_next(&ch->out),
+            struct dill_chcl, cl.epitem);
+        chcl->n = dill_chan_store(ch, dill_craddr(chcl->cl.cr, chcl->val),
+            chcl->n);
+        dill_trigger(&chcl->cl, 0);
+    }
+    return i;
+}
+
+/* Cross-thread channels. Being woken up by the channel doesn't mean that
+   the operation will succeed, only that it may. Therefore, the operation is
+   retried after each wakeup. */
+
+static int dill_chan_mttry(struct dill_chmt_ref *ref, int op, void *val) {
+    return op == CHSEND ? dill_chmt_trysend(ref, val) :
+        dill_chmt_tryrecv(ref, val);
+}
+
+static int dill_chan_mtop(struct dill_chmt_ref *ref, int op, void *val,
+      int64_t deadline) {
+    while(1) {
+        int rc = dill_chan_mttry(ref, op, val);
+        if(rc != 0) return rc > 0 ? 0 : -1;
+        /* The clause is not available immediately. */
+        if(dill_slow(deadline == 0)) {errno = ETIMEDOUT; return -1;}
+        struct dill_chmtwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+        if(dill_slow(!wt)) return -1;
+        rc = dill_chmt_prepare(ref, &wt->w, op);
+        if(dill_slow(rc < 0)) {dill_clfree(&wt_, wt); return -1;}
+        /* Retry once registered so that no wakeup can be missed. */
+        rc = dill_chan_mttry(ref, op, val);
+        if(rc != 0) {
+            int err = errno;
+            dill_chmt_unwait(ref, &wt->w, 0);
+            dill_clfree(&wt_, wt);
+            errno = err;
+            return rc > 0 ? 0 : -1;
+        }
+        /* Let's wait. */
+        dill_chmt_waitfor(ref, &wt->w, 0);
+        dill_timer(&wt->tmcl, 1, deadline);
+        int id = dill_wait();
+        int err = errno;
+        dill_chmt_unwait(ref, &wt->w, id == 0 && err == 0);
+        int detached = wt->w.detached;
+        dill_clfree(&wt_, wt);
+        if(dill_slow(id < 0)) {errno = err; return -1;}
+        if(dill_slow(id == 1)) {errno = ETIMEDOUT; return -1;}
+        /* The handle was closed. */
+        if(dill_slow(err != 0 || detached)) {errno = EPIPE; return -1;}
+    }
+}
+
+/* Moves as many items as possible, blocking only for the first one. */
+static ssize_t dill_chan_mtmany(struct dill_chmt_ref *ref, int op, char *vals,
+      size_t n, int64_t deadline) {
+    size_t sz = dill_chmt_itemsz(ref);
+    if(dill_slow(n == 0 || n > SSIZE_MAX || (sz > 0 && !vals))) {
+        errno = EINVAL; return -1;}
+    int rc = dill_chan_mtop(ref, op, vals, deadline);
+    if(dill_slow(rc < 0)) return -1;
+    size_t i;
+    for(i = 1; i != n; ++i) {
+        if(dill_chan_mttry(ref, op, vals + i * sz) <= 0) break;
+    }
+    errno = 0;
+    return i;
+}
+
+int chsend_ns(int h, const void *val, size_t len, int64_t deadline) {
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
     /* Get the channel interface. */
     struct dill_chan *ch = hquery(h, dill_chan_type);
-    if(dill_slow(!ch)) return -1;
+    if(dill_slow(!ch)) {
+        struct dill_chmt_ref *ref = hquery(h, dill_chmt_type);
+        if(dill_slow(!ref)) return -1;
+        if(dill_slow(len != dill_chmt_itemsz(ref))) {
+            errno = EINVAL; return -1;}
+        return dill_chan_mtop(ref, CHSEND, (void*)val, deadline);
+    }
     /* Check that the length provided matches the channel length */
-    if(dill_slow(len != ch->sz)) return -1;
+    if(dill_slow(len != ch->sz)) {errno = EINVAL; return -1;}
     /* Check if the channel is done. */
     if(dill_slow(ch->done)) {errno = EPIPE; return -1;}
-    if(!dill_list_empty(&ch->in)) {
-        /* Copy the message directly to the waiting receiver. */
-        struct dill_chcl *chcl = dill_cont(dill_list_next(&ch->in),
-            struct dill_chcl, cl.epitem);
-        memcpy(chcl->val, val, len);
-        dill_trigger(&chcl->cl, 0);
-        return 0;
-    }
+    /* Hand the message to a receiver or store it in the buffer. */
+    if(dill_chan_sendmany(ch, val, 1)) return 0;
     /* The clause is not available immediately. */
     if(dill_slow(deadline == 0)) {errno = ETIMEDOUT; return -1;}
     /* Let's wait. */
-    struct dill_chcl chcl;
-    chcl.val = (void*)val;
-    dill_waitfor(&chcl.cl, 0, &ch->out);
-    struct dill_tmcl tmcl;
-    dill_timer(&tmcl, 1, deadline);
+    struct dill_chwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+    if(dill_slow(!wt)) return -1;
+    wt->chcl.val = (void*)val;
+    wt->chcl.n = 1;
+    dill_waitfor(&wt->chcl.cl, 0, &ch->out);
+    dill_timer(&wt->tmcl, 1, deadline);
     int id = dill_wait();
+    dill_clfree(&wt_, wt);
     if(dill_slow(id < 0)) return -1;
     if(dill_slow(id == 1)) {errno = ETIMEDOUT; return -1;}
     if(dill_slow(errno != 0)) return -1;
     return 0;
 }
 
-int chrecv(int h, void *val, size_t len, int64_t deadline) {
+int chsend(int h, const void *val, size_t len, int64_t deadline) {
+    return chsend_ns(h, val, len, dill_ms2ns(deadline));
+}
+
+int chrecv_ns(int h, void *val, size_t len, int64_t deadline) {
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
     /* Get the channel interface. */
     struct dill_chan *ch = hquery(h, dill_chan_type);
-    if(dill_slow(!ch)) return -1;
-    /* Check that the length provided matches the channel length */
-    if(dill_slow(len != ch->sz)) return -1;
-    /* If there's a sender waiting copy the message directly from the sender. */
-    if(!dill_list_empty(&ch->out)) {
-        struct dill_chcl *chcl = dill_cont(dill_list_next(&ch->out),
-            struct dill_chcl, cl.epitem);
-        memcpy(val, chcl->val, len);
-        dill_trigger(&chcl->cl, 0);
-        return 0;
+    if(dill_slow(!ch)) {
+        struct dill_chmt_ref *ref = hquery(h, dill_chmt_type);
+        if(dill_slow(!ref)) return -1;
+        if(dill_slow(len != dill_chmt_itemsz(ref))) {
+            errno = EINVAL; return -1;}
+        return dill_chan_mtop(ref, CHRECV, val, deadline);
     }
+    /* Check that the length provided matches the channel length */
+    if(dill_slow(len != ch->sz)) {errno = EINVAL; return -1;}
+    /* Get a message from the buffer or from a waiting sender. Buffered
+       messages can be received even after chdone() was called. */
+    if(dill_chan_recvmany(ch, val, 1)) return 0;
     /* Check whether channel is done. */
     if(dill_slow(ch->done)) {errno = EPIPE; return -1;}
     /* The clause is not available immediately. */
     if(dill_slow(deadline == 0)) {errno = ETIMEDOUT; return -1;}
     /* Let's wait. */
-    struct dill_chcl chcl;
-    chcl.val = val;
-    dill_waitfor(&chcl.cl, 0, &ch->in);
-    struct dill_tmcl tmcl;
-    dill_timer(&tmcl, 1, deadline);
+    struct dill_chwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+    if(dill_slow(!wt)) return -1;
+    wt->chcl.val = val;
+    wt->chcl.n = 1;
+    dill_waitfor(&wt->chcl.cl, 0, &ch->in);
+    dill_timer(&wt->tmcl, 1, deadline);
     int id = dill_wait();
+    dill_clfree(&wt_, wt);
     if(dill_slow(id < 0)) return -1;
     if(dill_slow(id == 1)) {errno = ETIMEDOUT; return -1;}
     if(dill_slow(errno != 0)) return -1;
     return 0;
 }
 
+int chrecv(int h, void *val, size_t len, int64_t deadline) {
+    return chrecv_ns(h, val, len, dill_ms2ns(deadline));
+}
+
+/* Pointer channels pass only the reference to the data. The ownership of
+   the buffer is transferred to the receiver, the data itself is never
+   copied. */
+
+int chsend_ptr_ns(int h, void *ptr, size_t len, int64_t deadline) {
+    struct chptr p = {ptr, len};
+    return chsend_ns(h, &p, sizeof(p), deadline);
+}
+
+int chsend_ptr(int h, void *ptr, size_t len, int64_t deadline) {
+    return chsend_ptr_ns(h, ptr, len, dill_ms2ns(deadline));
+}
+
+int chrecv_ptr_ns(int h, void **ptr, size_t *len, int64_t deadline) {
+    if(dill_slow(!ptr)) {errno = EINVAL; return -1;}
+    struct chptr p;
+    int rc = chrecv_ns(h, &p, sizeof(p), deadline);
+    if(dill_slow(rc < 0)) return -1;
+    *ptr = p.ptr;
+    if(len) *len = p.len;
+    return 0;
+}
+
+int chrecv_ptr(int h, void **ptr, size_t *len, int64_t deadline) {
+    return chrecv_ptr_ns(h, ptr, len, dill_ms2ns(deadline));
+}
+
+ssize_t chsendv_ns(int h, const void *vals, size_t n, int64_t deadline) {
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    /* Get the channel interface. */
+    struct dill_chan *ch = hquery(h, dill_chan_type);
+    if(dill_slow(!ch)) {
+        struct dill_chmt_ref *ref = hquery(h, dill_chmt_type);
+        if(dill_slow(!ref)) return -1;
+        return dill_chan_mtmany(ref, CHSEND, (char*)vals, n, deadline);
+    }
+    if(dill_slow(n == 0 || n > SSIZE_MAX || (ch->sz > 0 && !vals))) {
+        errno = EINVAL; return -1;}
+    /* Check if the channel is done. */
+    if(dill_slow(ch->done)) {errno = EPIPE; return -1;}
+    /* Pass as many items to the waiting receivers and to the buffer as
+       possible. All the receivers will be resumed in the same scheduling
+       round. */
+    size_t sent = dill_chan_sendmany(ch, vals, n);
+    if(sent > 0) return sent;
+    /* No item can be sent immediately. */
+    if(dill_slow(deadline == 0)) {errno = ETIMEDOUT; return -1;}
+    /* Let's wait for a receiver. It takes as many items as it has space
+       for. */
+    struct dill_chwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+    if(dill_slow(!wt)) return -1;
+    wt->chcl.val = (void*)vals;
+    wt->chcl.n = n;
+    dill_waitfor(&wt->chcl.cl, 0, &ch->out);
+    dill_timer(&wt->tmcl, 1, deadline);
+    int id = dill_wait();
+    sent = wt->chcl.n;
+    dill_clfree(&wt_, wt);
+    if(dill_slow(id < 0)) return -1;
+    if(dill_slow(id == 1)) {errno = ETIMEDOUT; return -1;}
+    if(dill_slow(errno != 0)) return -1;
+    /* The channel may have been closed while we were waiting. */
+    ch = hquery(h, dill_chan_type);
+    if(dill_slow(!ch || ch->done || sent == n)) {errno = 0; return sent;}
+    return sent + dill_chan_sendmany(ch, (const char*)vals + sent * ch->sz,
+        n - sent);
+}
+
+ssize_t chsendv(int h, const void *vals, size_t n, int64_t deadline) {
+    return chsendv_ns(h, vals, n, dill_ms2ns(deadline));
+}
+
+ssize_t chrecvv_ns(int h, void *vals, size_t n, int64_t deadline) {
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    /* Get the channel interface. */
+    struct dill_chan *ch = hquery(h, dill_chan_type);
+    if(dill_slow(!ch)) {
+        struct dill_chmt_ref *ref = hquery(h, dill_chmt_type);
+        if(dill_slow(!ref)) return -1;
+        return dill_chan_mtmany(ref, CHRECV, vals, n, deadline);
+    }
+    if(dill_slow(n == 0 || n > SSIZE_MAX || (ch->sz > 0 && !vals))) {
+        errno = EINVAL; return -1;}
+    /* Drain the buffer and all the waiting senders. All the senders will be
+       resumed in the same scheduling round. */
+    size_t received = dill_chan_recvmany(ch, vals, n);
+    if(received > 0) return received;
+    /* Check whether channel is done. */
+    if(dill_slow(ch->done)) {errno = EPIPE; return -1;}
+    /* No item can be received immediately. */
+    if(dill_slow(deadline == 0)) {errno = ETIMEDOUT; return -1;}
+    /* Let's wait for a sender. It gives away as many items as there is
+       space for. */
+    struct dill_chwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+    if(dill_slow(!wt)) return -1;
+    wt->chcl.val = vals;
+    wt->chcl.n = n;
+    dill_waitfor(&wt->chcl.cl, 0, &ch->in);
+    dill_timer(&wt->tmcl, 1, deadline);
+    int id = dill_wait();
+    received = wt->chcl.n;
+    dill_clfree(&wt_, wt);
+    if(dill_slow(id < 0)) return -1;
+    if(dill_slow(id == 1)) {errno = ETIMEDOUT; return -1;}
+    if(dill_slow(errno != 0)) return -1;
+    /* The channel may have been closed while we were waiting. */
+    ch = hquery(h, dill_chan_type);
+    if(dill_slow(!ch || received == n)) {errno = 0; return received;}
+    return received + dill_chan_recvmany(ch,
+        (char*)vals + received * ch->sz, n - received);
+}
+
+ssize_t chrecvv(int h, void *vals, size_t n, int64_t deadline) {
+    return chrecvv_ns(h, vals, n, dill_ms2ns(deadline));
+}
+
 int chdone(int h) {
     struct dill_chan *ch = hquery(h, dill_chan_type);
-    if(dill_slow(!ch)) return -1;
+    if(dill_slow(!ch)) {
+        struct dill_chmt_ref *ref = hquery(h, dill_chmt_type);
+        if(dill_slow(!ref)) return -1;
+        return dill_chmt_done(ref);
+    }
     if(ch->done) {errno = EPIPE; return -1;}
     ch->done = 1;
     /* Resume any remaining senders and receivers on the channel
@@ -213,59 +532,152 @@ int chdone(int h) {
     return 0;
 }
 
-int choose(struct chclause *clauses, int nclauses, int64_t deadline) {
+int choose_ns(struct chclause *clauses, int nclauses, int64_t deadline) {
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
     if(dill_slow(nclauses < 0 || (nclauses != 0 && !clauses))) {
         errno = EINVAL; return -1;}
+    /* Cross-thread channels, if any. NULL for ordinary channels. */
+    struct dill_chmt_ref *refs[nclauses];
+    int mt = 0;
+    int fds = 0;
     int i;
+retry:
     for(i = 0; i != nclauses; ++i) {
         struct chclause *cl = &clauses[i];
+        refs[i] = NULL;
+        /* Readiness of file descriptors is only known after polling. */
+        if(cl->op == CHFDIN || cl->op == CHFDOUT) {fds = 1; continue;}
         struct dill_chan *ch = hquery(cl->ch, dill_chan_type);
-        if(dill_slow(!ch)) return i;
+        if(dill_slow(!ch)) {
+            refs[i] = hquery(cl->ch, dill_chmt_type);
+            if(dill_slow(!refs[i])) return i;
+            if(dill_slow(cl->len != dill_chmt_itemsz(refs[i]) ||
+                  (cl->len > 0 && !cl->val))) {
+                errno = EINVAL; return i;}
+            if(dill_slow(cl->op != CHSEND && cl->op != CHRECV)) {
+                errno = EINVAL; return i;}
+            mt = 1;
+            rc = dill_chan_mttry(refs[i], cl->op, cl->val);
+            if(rc == 0) continue;
+            if(rc > 0) errno = 0;
+            return i;
+        }
         if(dill_slow(cl->len != ch->sz || (cl->len > 0 && !cl->val))) {
             errno = EINVAL; return i;}
-        struct dill_chcl *chcl;
         switch(cl->op) {
         case CHSEND:
             if(dill_slow(ch->done)) {errno = EPIPE; return i;}
-            if(dill_list_empty(&ch->in)) break;
-            chcl = dill_cont(dill_list_next(&ch->in),
-                struct dill_chcl, cl.epitem);
-            memcpy(chcl->val, cl->val, cl->len);
-            dill_trigger(&chcl->cl, 0);
+            if(!dill_chan_sendmany(ch, cl->val, 1)) break;
             errno = 0;
             return i;
         case CHRECV:
+            if(dill_chan_recvmany(ch, cl->val, 1)) {errno = 0; return i;}
             if(dill_slow(ch->done)) {errno = EPIPE; return i;}
-            if(dill_list_empty(&ch->out)) break;
-            chcl = dill_cont(dill_list_next(&ch->out),
-                struct dill_chcl, cl.epitem);
-            memcpy(cl->val, chcl->val, ch->sz);
-            dill_trigger(&chcl->cl, 0);
-            errno = 0;
-            return i;
+            break;
         default:
             errno = EINVAL;
             return i;
         } 
     }
     /* There are no clauses available immediately. */
-    if(dill_slow(deadline == 0)) {errno = ETIMEDOUT; return -1;}
+    if(dill_slow(deadline == 0 && !fds)) {errno = ETIMEDOUT; return -1;}
+    struct dill_chcl chcls_[nclauses];
+    struct dill_chmt_waiter ws_[mt ? nclauses : 1];
+    struct dill_tmcl tmcl_;
+    struct dill_chcl *chcls = dill_clalloc(chcls_, sizeof(chcls_));
+    struct dill_chmt_waiter *ws = dill_clalloc(ws_, sizeof(ws_));
+    struct dill_tmcl *tmcl = dill_clalloc(&tmcl_, sizeof(tmcl_));
+    if(dill_slow(!chcls || !ws || !tmcl)) {
+        dill_clfree(chcls_, chcls);
+        dill_clfree(ws_, ws);
+        dill_clfree(&tmcl_, tmcl);
+        errno = ENOMEM;
+        return -1;
+    }
+    /* Add all the file descriptors to the pollset in one go. */
+    if(fds) {
+        for(i = 0; i != nclauses; ++i) {
+            if(clauses[i].op == CHFDIN)
+                rc = dill_in(&chcls[i].cl, i, clauses[i].ch);
+            else if(clauses[i].op == CHFDOUT)
+                rc = dill_out(&chcls[i].cl, i, clauses[i].ch);
+            else
+                continue;
+            if(dill_slow(rc < 0)) {
+                dill_unwait();
+                rc = i;
+                goto done;
+            }
+        }
+    }
+    /* Register with cross-thread channels and retry the operations so that
+       no wakeup can be missed. */
+    if(dill_slow(mt)) {
+        for(i = 0; i != nclauses; ++i) {
+            if(!refs[i]) continue;
+            rc = dill_chmt_prepare(refs[i], &ws[i], clauses[i].op);
+            if(dill_slow(rc < 0)) break;
+        }
+        int j = i;
+        if(i == nclauses) {
+            for(j = 0; j != nclauses; ++j) {
+                if(!refs[j]) continue;
+                rc = dill_chan_mttry(refs[j], clauses[j].op, clauses[j].val);
+                if(rc != 0) break;
+            }
+        }
+        if(dill_slow(j != nclauses || i != nclauses)) {
+            int err = rc > 0 ? 0 : errno;
+            int k;
+            for(k = 0; k != i; ++k)
+                if(refs[k]) dill_chmt_unwait(refs[k], &ws[k], 0);
+            if(fds) dill_unwait();
+            errno = err;
+            rc = i != nclauses ? -1 : j;
+            goto done;
+        }
+    }
     /* Let's wait. */
-    struct dill_chcl chcls[nclauses];
     for(i = 0; i != nclauses; ++i) {
+        if(dill_slow(refs[i])) {
+            dill_chmt_waitfor(refs[i], &ws[i], i);
+            continue;
+        }
+        if(clauses[i].op == CHFDIN || clauses[i].op == CHFDOUT) continue;
         struct dill_chan *ch = hquery(clauses[i].ch, dill_chan_type);
         dill_assert(ch);
         chcls[i].val = clauses[i].val;
+        chcls[i].n = 1;
         dill_waitfor(&chcls[i].cl, i,
             clauses[i].op == CHRECV ? &ch->in : &ch->out);
     }
-    struct dill_tmcl tmcl;
-    dill_timer(&tmcl, nclauses, deadline);
+    dill_timer(tmcl, nclauses, deadline);
     int id = dill_wait();
-    if(dill_slow(id < 0)) return -1;
-    if(dill_slow(id == nclauses)) {errno = ETIMEDOUT; return -1;}
-    return id;
+    rc = id;
+    if(dill_slow(mt)) {
+        int err = errno;
+        for(i = 0; i != nclauses; ++i)
+            if(refs[i]) dill_chmt_unwait(refs[i], &ws[i], i == id && !err);
+        /* Cross-thread channel may be ready. Try again. */
+        if(id >= 0 && id < nclauses && refs[id] && !err) {
+            if(dill_slow(ws[id].detached)) {errno = EPIPE; goto done;}
+            dill_clfree(chcls_, chcls);
+            dill_clfree(ws_, ws);
+            dill_clfree(&tmcl_, tmcl);
+            goto retry;
+        }
+        errno = err;
+    }
+    if(dill_slow(id == nclauses)) {errno = ETIMEDOUT; rc = -1;}
+done:
+    dill_clfree(chcls_, chcls);
+    dill_clfree(ws_, ws);
+    dill_clfree(&tmcl_, tmcl);
+    return rc;
+}
+
+int choose(struct chclause *clauses, int nclauses, int64_t deadline) {
+    return choose_ns(clauses, nclauses, dill_ms2ns(deadline));
 }
 
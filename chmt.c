@@ -0,0 +1,424 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined DILL_THREADS
+#include <pthread.h>
+#endif
+
+#include "chmt.h"
+#include "cr.h"
+#include "libdill.h"
+#include "list.h"
+#include "pollset.h"
+#include "utils.h"
+
+#define DILL_CACHELINE 64
+
+/* Items are stored in a bounded lock-free MPMC queue (see D. Vyukov,
+   "Bounded MPMC queue"). Each cell is prefixed by a sequence number which
+   tells whether the cell is ready to be written to or read from. The lists
+   of waiting coroutines are guarded by a lock, but they are touched only
+   when the channel is full or empty. */
+
+struct dill_chmt_cell {
+    size_t seq;
+};
+
+struct dill_chmt {
+    /* Position of the next item to be written. */
+    size_t enqpos __attribute__((aligned(DILL_CACHELINE)));
+    /* Position of the next item to be read. */
+    size_t deqpos __attribute__((aligned(DILL_CACHELINE)));
+    /* Read-only part. */
+    size_t sz __attribute__((aligned(DILL_CACHELINE)));
+    /* Number of cells. The queue needs at least two cells to tell a full
+       cell from an empty one, so it may be greater than the capacity. */
+    size_t cap;
+    /* Capacity of the channel as requested by the user. */
+    size_t limit;
+    /* Size of a cell, including the sequence number. */
+    size_t stride;
+    char *cells;
+    /* Number of handles, in all threads, referring to the channel. */
+    int refcount;
+    /* 1 if chdone() was already called. */
+    int done;
+    /* Number of waiters in each list. Used to avoid taking the lock when
+       there's nobody to wake up. */
+    int nrecvw;
+    int nsendw;
+#if defined DILL_THREADS
+    pthread_mutex_t lock;
+#endif
+    struct dill_list recvw;
+    struct dill_list sendw;
+};
+
+/* Thread-local handle to the channel. */
+struct dill_chmt_ref {
+    /* Table of virtual functions. */
+    struct hvfs vfs;
+    struct dill_chmt *mt;
+    /* Coroutines in this thread blocked on the channel via this handle. */
+    struct dill_list waiters;
+};
+
+#if defined DILL_THREADS
+#define dill_chmt_lock(mt) pthread_mutex_lock(&(mt)->lock)
+#define dill_chmt_unlock(mt) pthread_mutex_unlock(&(mt)->lock)
+#else
+#define dill_chmt_lock(mt)
+#define dill_chmt_unlock(mt)
+#endif
+
+static const int dill_chmt_type_placeholder = 0;
+const void *dill_chmt_type = &dill_chmt_type_placeholder;
+static void *dill_chmt_query(struct hvfs *vfs, const void *type);
+static void dill_chmt_close(struct hvfs *vfs);
+
+/******************************************************************************/
+/*  The queue.                                                                */
+/******************************************************************************/
+
+#define dill_chmt_cell(mt, pos) \
+    ((struct dill_chmt_cell*)((mt)->cells + ((pos) % (mt)->cap) *\
+    (mt)->stride))
+
+static int dill_chmt_enqueue(struct dill_chmt *mt, const void *val) {
+    size_t pos = __atomic_load_n(&mt->enqpos, __ATOMIC_RELAXED);
+    struct dill_chmt_cell *cell;
+    while(1) {
+        cell = dill_chmt_cell(mt, pos);
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if(dif == 0) {
+            /* There's a free cell but the channel may be full anyway. */
+            if(dill_slow(mt->limit < mt->cap && pos - __atomic_load_n(
+                  &mt->deqpos, __ATOMIC_ACQUIRE) >= mt->limit))
+                return 0;
+            if(__atomic_compare_exchange_n(&mt->enqpos, &pos, pos + 1, 1,
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        /* The queue is full. */
+        else if(dif < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&mt->enqpos, __ATOMIC_RELAXED);
+    }
+    memcpy(cell + 1, val, mt->sz);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int dill_chmt_dequeue(struct dill_chmt *mt, void *val) {
+    size_t pos = __atomic_load_n(&mt->deqpos, __ATOMIC_RELAXED);
+    struct dill_chmt_cell *cell;
+    while(1) {
+        cell = dill_chmt_cell(mt, pos);
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(dif == 0) {
+            if(__atomic_compare_exchange_n(&mt->deqpos, &pos, pos + 1, 1,
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        /* The queue is empty. */
+        else if(dif < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&mt->deqpos, __ATOMIC_RELAXED);
+    }
+    memcpy(val, cell + 1, mt->sz);
+    __atomic_store_n(&cell->seq, pos + mt->cap, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Wakes up the first waiter in the list, if any. Must be called with
+   the lock held. */
+static void dill_chmt_signal(struct dill_list *waiters, int *nwaiters) {
+    if(dill_list_empty(waiters)) return;
+    struct dill_chmt_waiter *w = dill_cont(dill_list_next(waiters),
+        struct dill_chmt_waiter, item);
+    dill_list_erase(&w->item);
+    w->listed = 0;
+    __atomic_sub_fetch(nwaiters, 1, __ATOMIC_SEQ_CST);
+    dill_pollset_signal(&w->rcl);
+}
+
+/* Wakes up one of the waiters, if there are any. */
+static void dill_chmt_wakeone(struct dill_chmt *mt, struct dill_list *waiters,
+      int *nwaiters) {
+    /* Pairs with the fence in dill_chmt_prepare(). Either we see the waiter
+       or the waiter sees the change to the queue. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(dill_fast(!__atomic_load_n(nwaiters, __ATOMIC_RELAXED))) return;
+    dill_chmt_lock(mt);
+    dill_chmt_signal(waiters, nwaiters);
+    dill_chmt_unlock(mt);
+}
+
+/******************************************************************************/
+/*  Channel creation and deallocation.                                        */
+/******************************************************************************/
+
+static int dill_chmt_makeref(struct dill_chmt *mt) {
+    struct dill_chmt_ref *ref = malloc(sizeof(struct dill_chmt_ref));
+    if(dill_slow(!ref)) {errno = ENOMEM; return -1;}
+    ref->vfs.query = dill_chmt_query;
+    ref->vfs.close = dill_chmt_close;
+    ref->mt = mt;
+    dill_list_init(&ref->waiters);
+    int h = hmake(&ref->vfs);
+    if(dill_slow(h < 0)) {
+        int err = errno;
+        free(ref);
+        errno = err;
+        return -1;
+    }
+    return h;
+}
+
+static void dill_chmt_release(struct dill_chmt *mt) {
+    if(__atomic_sub_fetch(&mt->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+    dill_assert(dill_list_empty(&mt->recvw));
+    dill_assert(dill_list_empty(&mt->sendw));
+#if defined DILL_THREADS
+    pthread_mutex_destroy(&mt->lock);
+#endif
+    free(mt);
+}
+
+int chmake_mt(size_t itemsz, size_t capacity) {
+    if(dill_slow(capacity == 0)) {errno = EINVAL; return -1;}
+    size_t ncells = capacity < 2 ? 2 : capacity;
+    size_t stride = (sizeof(struct dill_chmt_cell) + itemsz +
+        sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+    if(dill_slow(stride < itemsz || ncells >
+          (SIZE_MAX - sizeof(struct dill_chmt)) / stride)) {
+        errno = EINVAL; return -1;}
+    struct dill_chmt *mt;
+    int rc = posix_memalign((void**)&mt, DILL_CACHELINE,
+        sizeof(struct dill_chmt) + ncells * stride);
+    if(dill_slow(rc != 0)) {errno = ENOMEM; return -1;}
+    mt->enqpos = 0;
+    mt->deqpos = 0;
+    mt->sz = itemsz;
+    mt->cap = ncells;
+    mt->limit = capacity;
+    mt->stride = stride;
+    mt->cells = (char*)(mt + 1);
+    size_t i;
+    for(i = 0; i != ncells; ++i)
+        dill_chmt_cell(mt, i)->seq = i;
+    mt->refcount = 1;
+    mt->done = 0;
+    mt->nrecvw = 0;
+    mt->nsendw = 0;
+#if defined DILL_THREADS
+    rc = pthread_mutex_init(&mt->lock, NULL);
+    if(dill_slow(rc != 0)) {free(mt); errno = ENOMEM; return -1;}
+#endif
+    dill_list_init(&mt->recvw);
+    dill_list_init(&mt->sendw);
+    int h = dill_chmt_makeref(mt);
+    if(dill_slow(h < 0)) {
+        int err = errno;
+        dill_chmt_release(mt);
+        errno = err;
+        return -1;
+    }
+    return h;
+}
+
+void *chexport(int h) {
+    struct dill_chmt_ref *ref = hquery(h, dill_chmt_type);
+    if(dill_slow(!ref)) return NULL;
+    __atomic_add_fetch(&ref->mt->refcount, 1, __ATOMIC_RELAXED);
+    return ref->mt;
+}
+
+int chimport(void *mt) {
+    if(dill_slow(!mt)) {errno = EINVAL; return -1;}
+    int h = dill_chmt_makeref(mt);
+    if(dill_slow(h < 0)) {
+        int err = errno;
+        dill_chmt_release(mt);
+        errno = err;
+        return -1;
+    }
+    return h;
+}
+
+static void *dill_chmt_query(struct hvfs *vfs, const void *type) {
+    if(dill_fast(type == dill_chmt_type)) return vfs;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static void dill_chmt_close(struct hvfs *vfs) {
+    struct dill_chmt_ref *ref = (struct dill_chmt_ref*)vfs;
+    struct dill_chmt *mt = ref->mt;
+    /* Detach all the local waiters first. Once detached, the waiters won't
+       touch the handle any more. */
+    struct dill_list *it;
+    dill_chmt_lock(mt);
+    for(it = dill_list_next(&ref->waiters); it != &ref->waiters;
+          it = dill_list_next(it)) {
+        struct dill_chmt_waiter *w = dill_cont(it, struct dill_chmt_waiter,
+            local);
+        if(w->listed) {
+            dill_list_erase(&w->item);
+            w->listed = 0;
+            __atomic_sub_fetch(w->op == CHSEND ? &mt->nsendw : &mt->nrecvw,
+                1, __ATOMIC_SEQ_CST);
+        }
+        w->detached = 1;
+    }
+    dill_chmt_unlock(mt);
+    /* Resume the waiters that are still blocked with EPIPE error. Some of
+       them may have been resumed already but haven't run yet. */
+    for(it = dill_list_next(&ref->waiters); it != &ref->waiters;
+          it = dill_list_next(it)) {
+        struct dill_chmt_waiter *w = dill_cont(it, struct dill_chmt_waiter,
+            local);
+        if(w->waiting) dill_trigger(&w->rcl.cl, EPIPE);
+    }
+    dill_chmt_release(mt);
+    free(ref);
+}
+
+/******************************************************************************/
+/*  Sending and receiving.                                                    */
+/******************************************************************************/
+
+size_t dill_chmt_itemsz(struct dill_chmt_ref *ref) {
+    return ref->mt->sz;
+}
+
+int dill_chmt_trysend(struct dill_chmt_ref *ref, const void *val) {
+    struct dill_chmt *mt = ref->mt;
+    if(dill_slow(__atomic_load_n(&mt->done, __ATOMIC_ACQUIRE))) {
+        errno = EPIPE; return -1;}
+    if(!dill_chmt_enqueue(mt, val)) return 0;
+    dill_chmt_wakeone(mt, &mt->recvw, &mt->nrecvw);
+    return 1;
+}
+
+int dill_chmt_tryrecv(struct dill_chmt_ref *ref, void *val) {
+    struct dill_chmt *mt = ref->mt;
+    if(dill_chmt_dequeue(mt, val)) {
+        dill_chmt_wakeone(mt, &mt->sendw, &mt->nsendw);
+        return 1;
+    }
+    /* Items sent before chdone() was called can still be received. */
+    if(dill_slow(__atomic_load_n(&mt->done, __ATOMIC_ACQUIRE))) {
+        if(dill_chmt_dequeue(mt, val)) return 1;
+        errno = EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+static void dill_chmt_cancel(struct dill_clause *cl) {
+    struct dill_chmt_waiter *w = dill_cont(cl, struct dill_chmt_waiter,
+        rcl.cl);
+    dill_list_erase(&cl->epitem);
+    w->waiting = 0;
+}
+
+int dill_chmt_prepare(struct dill_chmt_ref *ref, struct dill_chmt_waiter *w,
+      int op) {
+    struct dill_chmt *mt = ref->mt;
+    int rc = dill_pollset_rcl(&w->rcl);
+    if(dill_slow(rc < 0)) return -1;
+    w->op = op;
+    w->waiting = 0;
+    w->detached = 0;
+    dill_list_insert(&w->local, &ref->waiters);
+    dill_chmt_lock(mt);
+    if(op == CHSEND) {
+        dill_list_insert(&w->item, &mt->sendw);
+        __atomic_add_fetch(&mt->nsendw, 1, __ATOMIC_SEQ_CST);
+    }
+    else {
+        dill_list_insert(&w->item, &mt->recvw);
+        __atomic_add_fetch(&mt->nrecvw, 1, __ATOMIC_SEQ_CST);
+    }
+    w->listed = 1;
+    dill_chmt_unlock(mt);
+    /* Pairs with the fence in dill_chmt_wakeone(). */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return 0;
+}
+
+void dill_chmt_waitfor(struct dill_chmt_ref *ref, struct dill_chmt_waiter *w,
+      int id) {
+    dill_pollset_remote(&w->rcl, id);
+    w->rcl.cl.cancel = dill_chmt_cancel;
+    w->waiting = 1;
+}
+
+void dill_chmt_unwait(struct dill_chmt_ref *ref, struct dill_chmt_waiter *w,
+      int consumed) {
+    /* If the handle was closed, it may not exist any more. */
+    if(w->detached) return;
+    dill_list_erase(&w->local);
+    struct dill_chmt *mt = ref->mt;
+    struct dill_list *waiters = w->op == CHSEND ? &mt->sendw : &mt->recvw;
+    int *nwaiters = w->op == CHSEND ? &mt->nsendw : &mt->nrecvw;
+    dill_chmt_lock(mt);
+    if(w->listed) {
+        dill_list_erase(&w->item);
+        w->listed = 0;
+        __atomic_sub_fetch(nwaiters, 1, __ATOMIC_SEQ_CST);
+    }
+    /* The waiter was signaled but it's not going to act on it. Pass the
+       wakeup to someone else so that it doesn't get lost. */
+    else if(!consumed)
+        dill_chmt_signal(waiters, nwaiters);
+    dill_chmt_unlock(mt);
+}
+
+int dill_chmt_done(struct dill_chmt_ref *ref) {
+    struct dill_chmt *mt = ref->mt;
+    if(__atomic_exchange_n(&mt->done, 1, __ATOMIC_ACQ_REL)) {
+        errno = EPIPE; return -1;}
+    /* Wake up everybody. Receivers will drain the queue and then fail with
+       EPIPE. Senders will fail straight away. */
+    dill_chmt_lock(mt);
+    while(!dill_list_empty(&mt->recvw))
+        dill_chmt_signal(&mt->recvw, &mt->nrecvw);
+    while(!dill_list_empty(&mt->sendw))
+        dill_chmt_signal(&mt->sendw, &mt->nsendw);
+    dill_chmt_unlock(mt);
+    return 0;
+}
+
@@ -0,0 +1,93 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef DILL_CHMT_INCLUDED
+#define DILL_CHMT_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+#include "pollset.h"
+
+/* Cross-thread channels. The channel itself is shared among threads. Each
+   thread accesses it via its own handle, which points to a dill_chmt_ref
+   object. Blocking operations on the channel are implemented in chan.c using
+   the functions below. */
+
+extern const void *dill_chmt_type;
+
+struct dill_chmt_ref;
+
+/* Coroutine waiting for a cross-thread channel. */
+struct dill_chmt_waiter {
+    /* Clause that is signaled when the channel may be ready. */
+    struct dill_rcl rcl;
+    /* Item in the channel's list of waiting senders or receivers. */
+    struct dill_list item;
+    /* Item in the list of waiters blocked via the local handle. */
+    struct dill_list local;
+    /* CHSEND or CHRECV. */
+    int op;
+    /* 1 if 'item' is in the channel's list of waiters. If the waiter was
+       removed from the list by someone else, it was signaled. */
+    unsigned int listed : 1;
+    /* 1 if the coroutine is blocked waiting for the clause. */
+    unsigned int waiting : 1;
+    /* 1 if the handle was closed in the meantime. The waiter must not touch
+       the handle any more. */
+    unsigned int detached : 1;
+};
+
+/* Size of the items in the channel. */
+size_t dill_chmt_itemsz(struct dill_chmt_ref *ref);
+
+/* Try to send/receive an item without blocking. Return 1 in case of success,
+   0 if the operation would block, -1 if the channel is done. */
+int dill_chmt_trysend(struct dill_chmt_ref *ref, const void *val);
+int dill_chmt_tryrecv(struct dill_chmt_ref *ref, void *val);
+
+/* Register the waiter with the channel. After this function is called,
+   the operation has to be retried before waiting. Otherwise, the wakeup
+   could be lost. 'op' is either CHSEND or CHRECV. Each successful call must
+   be matched by a call to dill_chmt_unwait(). */
+int dill_chmt_prepare(struct dill_chmt_ref *ref, struct dill_chmt_waiter *w,
+    int op);
+
+/* Add the waiter to the list of current clauses of the coroutine. */
+void dill_chmt_waitfor(struct dill_chmt_ref *ref, struct dill_chmt_waiter *w,
+    int id);
+
+/* Unregister the waiter. 'consumed' should be set to 1 if the wakeup,
+   if any, was used to retry the operation. Otherwise, it is passed on
+   to another waiter. If 'detached' is set in the waiter the handle was
+   closed and it is not accessed. */
+void dill_chmt_unwait(struct dill_chmt_ref *ref, struct dill_chmt_waiter *w,
+    int consumed);
+
+/* Mark the channel as done and wake up all the waiters. */
+int dill_chmt_done(struct dill_chmt_ref *ref);
+
+#endif
+
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #if defined DILL_VALGRIND
@@ -31,6 +32,7 @@
 
 #include "cr.h"
 #include "fd.h"
+#include "now.h"
 #include "pollset.h"
 #include "stack.h"
 #include "utils.h"
@@ -38,15 +40,68 @@
 
 #if defined DILL_CENSUS
 
-/* When doing stack size census we will keep maximum stack size in a list
-   indexed by go() call, i.e. by file name and line number. */
+/* When doing stack size census we will keep maximum stack size in a hash
+   table indexed by go() call, i.e. by file name and line number. The file
+   name is compared by pointer. */
 struct dill_census_item {
-    struct dill_slist crs;
+    struct dill_slist item;
     const char *file;
     int line;
+    uint64_t count;
     size_t max_stack;
 };
 
+/* Finds the census item for the go() call site. Creates it if it doesn't
+   exist yet. */
+static struct dill_census_item *dill_census_find(struct dill_ctx_cr *ctx,
+      const char *file, int line) {
+    size_t hash = ((uintptr_t)file >> 3) * 31 + (size_t)line;
+    struct dill_slist *bucket = &ctx->census[hash % DILL_CENSUS_BUCKETS];
+    struct dill_slist *it;
+    for(it = dill_slist_next(bucket); it != bucket; it = dill_slist_next(it)) {
+        struct dill_census_item *ci =
+            dill_cont(it, struct dill_census_item, item);
+        if(ci->file == file && ci->line == line) return ci;
+    }
+    struct dill_census_item *ci = malloc(sizeof(struct dill_census_item));
+    dill_assert(ci);
+    ci->file = file;
+    ci->line = line;
+    ci->count = 0;
+    ci->max_stack = 0;
+    dill_slist_push(bucket, &ci->item);
+    ++ctx->ncensus;
+    return ci;
+}
+
+/* Records stack usage of a finished coroutine. */
+static void dill_census_record(struct dill_cr *cr) {
+#if HAVE_MINCORE
+    /* The stack is left alone so that it stays warm in the cache. Pages
+       touched by the earlier users of the stack, as well as lazily trimmed
+       pages, are still resident. The measurement is thus an upper bound. */
+    size_t used = dill_stack_used(cr + 1, cr->stacksz, cr->stackflags);
+    if(dill_slow(used == 0)) return;
+#else
+    /* Find first overwritten byte on the stack.
+       Determine stack usage based on that. */
+    size_t stacksz = cr->stacksz - sizeof(struct dill_cr);
+    uint8_t *bottom = ((uint8_t*)cr) - stacksz;
+    size_t i = cr->stackflags & DILL_STACK_CANARY ?
+        DILL_STACK_CANARY_SIZE : 0;
+    for(; i != stacksz; ++i)
+        if(bottom[i] != 0xa0 + (i % 13)) break;
+    if(dill_slow(i == stacksz)) return;
+    /* dill_cr is located on stack so we have take that to account.
+       Also, it may be necessary to align the top of the stack to
+       16-byte boundary, so add 16 bytes to account for that. */
+    size_t used = cr->stacksz - i + 16;
+#endif
+    ++cr->census->count;
+    if(used > cr->census->max_stack)
+        cr->census->max_stack = used;
+}
+
 #endif
 
 /* Storage for constant used by go() macro. */
@@ -89,27 +144,61 @@ int dill_ctx_cr_init(struct dill_ctx_cr *ctx) {
        without calling it. */
     ctx->r = &ctx->main;
     dill_qlist_init(&ctx->ready);
-    dill_list_init(&ctx->timers);
+#if defined DILL_TIMER_WHEEL
+    /* The wheel catches up with the current time lazily. */
+    dill_wheel_init(&ctx->timers, 0);
+#else
+    dill_heap_init(&ctx->timers);
+#endif
     ctx->wait_counter = 0;
+    /* 103 is a prime. That way it's less likely to coincide with some kind
+       of cycle in the user's code. */
+    ctx->wait_interval = 103;
+    ctx->fairpolls = 0;
+    ctx->spin = 0;
+    ctx->busypoll = 0;
+    ctx->spins = 0;
+    ctx->spinhits = 0;
+    ctx->spintime = 0;
     /* Initialize main coroutine. */
     memset(&ctx->main, 0, sizeof(ctx->main));
     ctx->main.ready.next = NULL;
     dill_slist_init(&ctx->main.clauses);
+    memset(&ctx->shared, 0, sizeof(ctx->shared));
 #if defined DILL_CENSUS
-    dill_slist_init(&ctx->census);
+    int i;
+    for(i = 0; i != DILL_CENSUS_BUCKETS; ++i)
+        dill_slist_init(&ctx->census[i]);
+    ctx->ncensus = 0;
 #endif
     return 0;
 }
 
 void dill_ctx_cr_term(struct dill_ctx_cr *ctx) {
+#if defined DILL_TIMER_WHEEL
+    dill_wheel_term(&ctx->timers);
+#else
+    dill_heap_term(&ctx->timers);
+#endif
+#if defined DILL_VALGRIND
+    if(ctx->shared.sw) VALGRIND_STACK_DEREGISTER(ctx->shared.swsid);
+#endif
+    free(ctx->shared.sw);
 #if defined DILL_CENSUS
-    struct dill_slist *it;
-    for(it = dill_slist_next(&ctx->census); it != &ctx->census;
-          it = dill_slist_next(it)) {
-        struct dill_census_item *ci =
-            dill_cont(it, struct dill_census_item, crs);
-        fprintf(stderr, "%s:%d - maximum stack size %zu B\n",
-            ci->file, ci->line, ci->max_stack);
+    int i;
+    for(i = 0; i != DILL_CENSUS_BUCKETS; ++i) {
+        struct dill_slist *it;
+        while((it = dill_slist_pop(&ctx->census[i])) != &ctx->census[i]) {
+            struct dill_census_item *ci =
+                dill_cont(it, struct dill_census_item, item);
+            /* Recommend twice the observed maximum to leave some headroom
+               for the code paths that weren't exercised. */
+            size_t rec = dill_stack_round(ci->max_stack * 2);
+            fprintf(stderr, "%s:%d - maximum stack size %zu B, "
+                "recommended stack size %zu B\n",
+                ci->file, ci->line, ci->max_stack, rec);
+            free(ci);
+        }
     }
 #endif
 }
@@ -118,24 +207,71 @@ void dill_ctx_cr_term(struct dill_ctx_cr *ctx) {
 /*  Poller.                                                                   */
 /******************************************************************************/
 
+/* Thin layer over the data structure used to store the timers.
+   All the times are in nanoseconds. */
+
+#if defined DILL_TIMER_WHEEL
+
+/* The wheel has millisecond resolution. Deadlines are rounded up so that
+   the timers never fire early. */
+static inline void dill_timers_add(struct dill_ctx_cr *ctx,
+      struct dill_tmcl *tmcl, int64_t deadline) {
+    tmcl->item.val = deadline / 1000000 + (deadline % 1000000 ? 1 : 0);
+    dill_wheel_add(&ctx->timers, &tmcl->item);
+}
+
+#define dill_timers_empty(ctx) dill_wheel_empty(&(ctx)->timers)
+#define dill_timers_erase(ctx, tmcl) \
+    dill_wheel_erase(&(ctx)->timers, &(tmcl)->item)
+#define dill_timers_next(ctx) (dill_wheel_next(&(ctx)->timers) * 1000000)
+
+/* Returns first expired timer or NULL if there's none. */
+static struct dill_tmcl *dill_timers_expired(struct dill_ctx_cr *ctx,
+      int64_t nw) {
+    return dill_cont(dill_wheel_top(&ctx->timers, nw / 1000000),
+        struct dill_tmcl, item);
+}
+
+#else
+
+static inline void dill_timers_add(struct dill_ctx_cr *ctx,
+      struct dill_tmcl *tmcl, int64_t deadline) {
+    tmcl->item.val = deadline;
+    dill_heap_push(&ctx->timers, &tmcl->item);
+}
+
+#define dill_timers_empty(ctx) dill_heap_empty(&(ctx)->timers)
+#define dill_timers_erase(ctx, tmcl) \
+    dill_heap_erase(&(ctx)->timers, &(tmcl)->item)
+#define dill_timers_next(ctx) dill_heap_top(&(ctx)->timers)->val
+
+/* Returns first expired timer or NULL if there's none. */
+static struct dill_tmcl *dill_timers_expired(struct dill_ctx_cr *ctx,
+      int64_t nw) {
+    struct dill_heap_item *item = dill_heap_top(&ctx->timers);
+    if(!item || item->val > nw) return NULL;
+    return dill_cont(item, struct dill_tmcl, item);
+}
+
+#endif
+
+/* Removes the timer from the set of active timers. */
+static void dill_timer_cancel(struct dill_clause *cl) {
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    struct dill_tmcl *tmcl = dill_cont(cl, struct dill_tmcl, cl);
+    dill_timers_erase(ctx, tmcl);
+}
+
 /* Adds a timer clause to the list of waited for clauses. */
 void dill_timer(struct dill_tmcl *tmcl, int id, int64_t deadline) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     /* If the deadline is infinite there's nothing to wait for. */
     if(deadline < 0) return;
-    /* Finite deadline. */
-    tmcl->deadline = deadline;
-    /* Move the timer into the right place in the ordered list
-       of existing timers. TODO: This is an O(n) operation! */
-    struct dill_list *it = dill_list_next(&ctx->timers);
-    while(it != &ctx->timers) {
-        struct dill_tmcl *itcl = dill_cont(it, struct dill_tmcl, cl.epitem);
-        /* If multiple timers expire at the same momemt they will be fired
-           in the order they were created in (> rather than >=). */
-        if(itcl->deadline > tmcl->deadline) break;
-        it = dill_list_next(it);
-    }
-    dill_waitfor(&tmcl->cl, id, it);
+    /* Finite deadline. If multiple timers expire at the same moment they
+       will be fired in the order they were created in. */
+    dill_timers_add(ctx, tmcl, deadline);
+    dill_waitfor(&tmcl->cl, id, NULL);
+    tmcl->cl.cancel = dill_timer_cancel;
 }
 
 int dill_in(struct dill_clause *cl, int id, int fd) {
@@ -152,36 +288,67 @@ void dill_clean(int fd) {
     dill_pollset_clean(fd);
 }
 
+/* Polls for events without blocking until a coroutine is resumed, the spin
+   budget is used up or 'timeout' nanoseconds pass. Returns 1 in the first
+   case, 0 otherwise. */
+static int dill_poller_spin(struct dill_ctx_cr *ctx, int64_t timeout) {
+    int64_t budget = ctx->spin;
+    if(timeout >= 0 && timeout < budget) budget = timeout;
+    int64_t start = dill_now_refresh();
+    int64_t nw;
+    int fired;
+    do {
+        fired = dill_pollset_poll(0);
+        nw = dill_now_refresh();
+    } while(fired <= 0 && nw - start < budget);
+    ++ctx->spins;
+    ctx->spintime += nw - start;
+    if(fired <= 0) return 0;
+    ++ctx->spinhits;
+    return 1;
+}
+
 /* Wait for external events such as timers or file descriptors. If block is set
    to 0 the function will poll for events and return immediately. If it is set
    to 1 it will block until there's at least one event to process. */
 static void dill_poller_wait(int block) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    int spun = 0;
+    /* The thread is about to go idle. Good time to give memory back. */
+    if(block) dill_stack_idle();
     while(1) {
-        /* Compute timeout for the subsequent poll. */
-        int timeout = 0;
+        /* Compute timeout for the subsequent poll. We are going to sleep
+           anyway so there's no point in using the cached time here. */
+        int64_t timeout = 0;
         if(block) {
-            if(dill_list_empty(&ctx->timers))
+            if(dill_timers_empty(ctx))
                 timeout = -1;
             else {
-                int64_t nw = now();
-                int64_t deadline = dill_cont(dill_list_next(&ctx->timers),
-                    struct dill_tmcl, cl.epitem)->deadline;
-                timeout = (int) (nw >= deadline ? 0 : deadline - nw);
+                int64_t nw = dill_now_refresh();
+                int64_t deadline = dill_timers_next(ctx);
+                timeout = nw >= deadline ? 0 : deadline - nw;
             }
         }
-        /* Wait for events. */
-        int fired = dill_pollset_poll(timeout);
+        /* Wait for events. In busy-poll mode, spin for a while first. If
+           nothing happens, compute the timeout anew as time has passed. */
+        int fired;
+        if(dill_slow(ctx->spin > 0 && timeout != 0 && !spun)) {
+            spun = 1;
+            fired = dill_poller_spin(ctx, timeout);
+            if(!fired) continue;
+        }
+        else
+            fired = dill_pollset_poll(timeout);
         if(dill_slow(fired < 0)) continue;
-        /* Fire all expired timers. */
-        if(!dill_list_empty(&ctx->timers)) {
-            int64_t nw = now();
-            while(!dill_list_empty(&ctx->timers)) {
-                struct dill_tmcl *tmcl = dill_cont(
-                    dill_list_next(&ctx->timers), struct dill_tmcl, cl.epitem);
-                if(tmcl->deadline > nw)
-                    break;
-                dill_list_erase(dill_list_next(&ctx->timers));
+        /* Fire all expired timers. Triggering the timer clause cancels it
+           and thus removes it from the set of active timers. Non-blocking
+           polls happen often so the cached time is used to check the timers.
+           After sleeping, precise time is retrieved. It also refreshes the
+           cached time. */
+        if(!dill_timers_empty(ctx)) {
+            int64_t nw = block ? dill_now_refresh() : dill_now();
+            struct dill_tmcl *tmcl;
+            while((tmcl = dill_timers_expired(ctx, nw))) {
                 dill_trigger(&tmcl->cl, ETIMEDOUT);
                 fired = 1;
             }
@@ -194,6 +361,39 @@ static void dill_poller_wait(int block) {
     }
 }
 
+int pollbatch(int size) {
+    return dill_batch_set(&dill_getctx->pollset.batch, size);
+}
+
+int pollinterval(int switches) {
+    if(dill_slow(switches <= 0)) {errno = EINVAL; return -1;}
+    dill_getctx->cr.wait_interval = switches;
+    return 0;
+}
+
+int pollspin(int usecs, int flags) {
+    if(dill_slow(usecs < 0 || (flags & ~POLLSPINSOCK))) {
+        errno = EINVAL; return -1;}
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    ctx->spin = (int64_t)usecs * 1000;
+    ctx->busypoll = flags & POLLSPINSOCK ? usecs : 0;
+    return 0;
+}
+
+int pollstats(struct pollstats *stats) {
+    if(dill_slow(!stats)) {errno = EINVAL; return -1;}
+    struct dill_batch *batch = &dill_getctx->pollset.batch;
+    stats->polls = batch->polls;
+    stats->events = batch->events;
+    stats->fullpolls = batch->fullpolls;
+    stats->fairpolls = dill_getctx->cr.fairpolls;
+    stats->spins = dill_getctx->cr.spins;
+    stats->spinhits = dill_getctx->cr.spinhits;
+    stats->spintime = dill_getctx->cr.spintime;
+    stats->batch = batch->size;
+    return 0;
+}
+
 /******************************************************************************/
 /*  Handle implementation.                                                    */
 /******************************************************************************/
@@ -209,8 +409,136 @@ static void dill_cr_close(struct hvfs *vfs);
 
 static void dill_cancel(struct dill_cr *cr, int err);
 
+/* Size of the stack used while copying data to the shared stack. */
+#define DILL_SHARED_SWSIZE 16384
+
+#if defined DILL_SHARED_STACK
+
+/* Records the stack pointer of the current coroutine. The callee's frame is
+   below the caller's stack pointer so all the caller's frames are above
+   the recorded address. */
+static __attribute__((noinline)) void dill_shared_leave(struct dill_cr *cr) {
+    volatile uint8_t here = 0;
+    cr->sp = (uint8_t*)((uintptr_t)&here & ~(uintptr_t)15);
+}
+
+/* Copies the coroutine's part of the shared stack to its private buffer.
+   The buffer is resized if it is too small or way too big. */
+static void dill_shared_save(struct dill_cr *cr) {
+    size_t len = cr->top - cr->sp;
+    if(dill_slow(len > cr->cap || len < cr->cap / 4)) {
+        size_t cap = (len + 255) & ~(size_t)255;
+        void *buf = realloc(cr->buf, cap);
+        dill_assert(buf);
+        cr->buf = buf;
+        cr->cap = cap;
+    }
+    memcpy(cr->buf, cr->sp, len);
+    cr->len = len;
+}
+
+/* Saves the current owner of the shared stack, restores the coroutine's
+   part of the shared stack and jumps to the coroutine. Must not be executed
+   on the shared stack. */
+static __attribute__((noinline)) void dill_shared_resume(
+      struct dill_ctx_cr *ctx, struct dill_cr *cr) {
+    if(ctx->shared.owner) dill_shared_save(ctx->shared.owner);
+    memcpy(cr->top - cr->len, cr->buf, cr->len);
+    ctx->shared.owner = cr;
+    dill_longjmp(cr->ctx);
+}
+
+/* Same as above, but switches to the auxiliary stack first. */
+static __attribute__((noinline)) void dill_shared_switch(
+      struct dill_ctx_cr *ctx, struct dill_cr *cr) {
+    DILL_SETSP(ctx->shared.swtop);
+    dill_shared_resume(ctx, cr);
+    /* Never reached. Prevents the above from being a tail call which would
+       restore the stack pointer before the jump. */
+    dill_assert(0);
+}
+
+/* Switches to a coroutine whose content is not on the shared stack. */
+static void dill_shared_jump(struct dill_ctx_cr *ctx, struct dill_cr *cr) {
+    uint8_t here;
+    if(&here < ctx->shared.top && &here >= ctx->shared.top - ctx->shared.size)
+        dill_shared_switch(ctx, cr);
+    dill_shared_resume(ctx, cr);
+}
+
+/* Allocates the shared stack, if it doesn't exist yet. */
+static int dill_shared_init(struct dill_ctx_cr *ctx) {
+    if(dill_fast(ctx->shared.top)) return 0;
+    if(!ctx->shared.sw) {
+        ctx->shared.sw = malloc(DILL_SHARED_SWSIZE);
+        if(dill_slow(!ctx->shared.sw)) {errno = ENOMEM; return -1;}
+        ctx->shared.swtop = (uint8_t*)(((uintptr_t)ctx->shared.sw +
+            DILL_SHARED_SWSIZE) & ~(uintptr_t)15);
+#if defined DILL_VALGRIND
+        ctx->shared.swsid = VALGRIND_STACK_REGISTER(ctx->shared.sw,
+            ctx->shared.swtop);
+#endif
+    }
+    size_t size = 0;
+    uint8_t *top = dill_allocstack(&size, &ctx->shared.flags);
+    if(dill_slow(!top)) return -1;
+    ctx->shared.top = top;
+    ctx->shared.size = size;
+    ctx->shared.owner = NULL;
+#if defined DILL_VALGRIND
+    ctx->shared.sid = VALGRIND_STACK_REGISTER(top - size, top);
+#endif
+    return 0;
+}
+
+/* Called when a shared-stack coroutine is closed. */
+static void dill_shared_term(struct dill_ctx_cr *ctx, struct dill_cr *cr) {
+    if(ctx->shared.owner == cr) ctx->shared.owner = NULL;
+    free(cr->buf);
+    free(cr);
+    /* Nobody uses the shared stack any more. Return it to the cache. */
+    if(--ctx->shared.count == 0) {
+#if defined DILL_VALGRIND
+        VALGRIND_STACK_DEREGISTER(ctx->shared.sid);
+#endif
+        dill_freestack(ctx->shared.top, ctx->shared.size, ctx->shared.flags);
+        ctx->shared.top = NULL;
+    }
+}
+
+void *dill_clalloc(void *local, size_t sz) {
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    if(dill_fast(!ctx->r->shared)) return local;
+    void *mem = malloc(sz ? sz : 1);
+    if(dill_slow(!mem)) {errno = ENOMEM; return NULL;}
+    return mem;
+}
+
+void dill_clfree(void *local, void *mem) {
+    if(dill_fast(mem == local)) return;
+    /* Preserve errno set by dill_wait(). */
+    int err = errno;
+    free(mem);
+    errno = err;
+}
+
+void *dill_craddr(struct dill_cr *cr, void *ptr) {
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    if(dill_fast(!cr->shared || cr == ctx->shared.owner)) return ptr;
+    uint8_t *p = ptr;
+    if(p < cr->sp || p >= cr->top) return ptr;
+    return (uint8_t*)cr->buf + (p - cr->sp);
+}
+
+int dill_inshared(void) {
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    return ctx->r->shared;
+}
+
+#endif
+
 /* The intial part of go(). Allocates a new stack and handle. */
-int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
+static int dill_prologue_(sigjmp_buf **jb, void **ptr, size_t len, int shared,
       const char *file, int line) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     /* Return ECANCELED if shutting down. */
@@ -218,9 +546,43 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
     if(dill_slow(rc < 0)) {errno = ECANCELED; return -1;}
     struct dill_cr *cr;
     size_t stacksz;
+    int stackflags = 0;
+#if defined DILL_SHARED_STACK
+    /* Parent is going to be suspended. If it runs on the shared stack,
+       remember where its part of the stack ends. */
+    if(ctx->r->shared) {
+        volatile uint8_t here = 0;
+        ctx->r->sp = (uint8_t*)((uintptr_t)&here & ~(uintptr_t)15);
+    }
+    uint8_t *top = NULL;
+    if(shared) {
+        rc = dill_shared_init(ctx);
+        if(dill_slow(rc < 0)) return -1;
+        /* If the parent runs on the shared stack, the new coroutine starts
+           below the parent's frames. That way, the parent's frames are not
+           overwritten while the new coroutine is being launched. */
+        top = ctx->r->shared ? ctx->r->sp - 256 : ctx->shared.top;
+        /* The bookkeeping info is kept on the heap rather than on the
+           stack. */
+        cr = malloc(sizeof(struct dill_cr));
+        if(dill_slow(!cr)) {
+            if(ctx->shared.count == 0) {
+                dill_freestack(ctx->shared.top, ctx->shared.size,
+                    ctx->shared.flags);
+                ctx->shared.top = NULL;
+            }
+            errno = ENOMEM;
+            return -1;
+        }
+        ++cr;
+        stacksz = 0;
+    }
+    else
+#endif
     if(!*ptr) {
-        /* Allocate new stack. */
-        cr = (struct dill_cr*)dill_allocstack(&stacksz);
+        /* Allocate new stack. If len is zero, default stack size is used. */
+        stacksz = len;
+        cr = (struct dill_cr*)dill_allocstack(&stacksz, &stackflags);
         if(dill_slow(!cr)) return -1;
     }
     else {
@@ -234,11 +596,11 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
         if(dill_slow(stacksz < sizeof(struct dill_cr))) {
             errno = ENOMEM; return -1;}
     }
-#if defined DILL_CENSUS
-    /* Mark the bytes in stack as unused. */
+#if defined DILL_CENSUS && !HAVE_MINCORE
+    /* Mark the bytes in stack as unused. Leave the canary alone. */
     uint8_t *bottom = ((char*)cr) - stacksz;
-    int i;
-    for(i = 0; i != stacksz; ++i)
+    size_t i = stackflags & DILL_STACK_CANARY ? DILL_STACK_CANARY_SIZE : 0;
+    for(; i < stacksz; ++i)
         bottom[i] = 0xa0 + (i % 13);
 #endif
     --cr;
@@ -246,7 +608,19 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
     cr->vfs.close = dill_cr_close;
     int hndl = hmake(&cr->vfs);
     if(dill_slow(hndl < 0)) {
-        int err = errno; dill_freestack(cr + 1); errno = err; return -1;}
+        int err = errno;
+#if defined DILL_SHARED_STACK
+        if(shared) {
+            cr->buf = NULL;
+            ++ctx->shared.count;
+            dill_shared_term(ctx, cr);
+        }
+        else
+#endif
+        if(!*ptr) dill_freestack(cr + 1, stacksz, stackflags);
+        errno = err;
+        return -1;
+    }
     cr->ready.next = NULL;
     dill_slist_init(&cr->clauses);
     cr->closer = NULL;
@@ -254,29 +628,26 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
     cr->no_blocking2 = 0;
     cr->done = 0;
     cr->mem = *ptr ? 1 : 0;
+    cr->shared = 0;
+    cr->stacksz = stacksz;
+    cr->stackflags = stackflags;
+#if defined DILL_SHARED_STACK
+    if(shared) {
+        cr->shared = 1;
+        cr->top = top;
+        cr->sp = top;
+        cr->buf = NULL;
+        cr->len = 0;
+        cr->cap = 0;
+        ++ctx->shared.count;
+    }
+#endif
 #if defined DILL_VALGRIND
-    cr->sid = VALGRIND_STACK_REGISTER((char*)(cr + 1) - stacksz, cr);
+    if(!cr->shared)
+        cr->sid = VALGRIND_STACK_REGISTER((char*)(cr + 1) - stacksz, cr);
 #endif
 #if defined DILL_CENSUS
-    /* Find the appropriate census item if it exists. It's O(n) but meh. */
-    cr->census = NULL;
-    struct dill_slist *it;
-    for(it = dill_slist_next(&ctx->census); it != &ctx->census;
-          it = dill_slist_next(it)) {
-        cr->census = dill_cont(it, struct dill_census_item, crs);
-        if(cr->census->line == line && strcmp(cr->census->file, file) == 0)
-            break;
-    }
-    /* Allocate it if it does not exist. */
-    if(it == &ctx->census) {
-        cr->census = malloc(sizeof(struct dill_census_item));
-        dill_assert(cr->census);
-        dill_slist_push(&ctx->census, &cr->census->crs);
-        cr->census->file = file;
-        cr->census->line = line;
-        cr->census->max_stack = 0;
-    }
-    cr->stacksz = stacksz - sizeof(struct dill_cr);
+    cr->census = dill_census_find(ctx, file, line);
 #endif
     /* Return the context of the parent coroutine to the caller so that it can
        store its current state. It can't be done here becuse we are at the
@@ -285,15 +656,47 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
     /* Add parent coroutine to the list of coroutines ready for execution. */
     dill_resume(ctx->r, 0, 0);
     /* Mark the new coroutine as running. */
-    *ptr = ctx->r = cr;
+    ctx->r = cr;
+#if defined DILL_SHARED_STACK
+    if(shared) {
+        *ptr = top;
+        return hndl;
+    }
+#endif
+    *ptr = cr;
     return hndl;
 }
 
+int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len,
+      const char *file, int line) {
+    return dill_prologue_(jb, ptr, len, 0, file, line);
+}
+
+int dill_prologue_shared(sigjmp_buf **jb, void **ptr,
+      const char *file, int line) {
+    return dill_prologue_(jb, ptr, 0, 1, file, line);
+}
+
+/* Called by go_shared() once the parent's state is stored. The parent
+   doesn't touch its frames from now on, so whoever owns the shared stack
+   can be moved out of the way. */
+void dill_shared_enter(void) {
+#if defined DILL_SHARED_STACK
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    if(ctx->shared.owner) dill_shared_save(ctx->shared.owner);
+    ctx->shared.owner = ctx->r;
+#endif
+}
+
 /* The final part of go(). Gets called one the coroutine is finished. */
 void dill_epilogue(void) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     /* Mark the coroutine as finished. */
     ctx->r->done = 1;
+#if defined DILL_SHARED_STACK
+    /* Content of the shared stack doesn't have to be preserved any more. */
+    if(ctx->r->shared) ctx->shared.owner = NULL;
+#endif
     /* If there's a coroutine waiting till we finish, unblock it now. */
     if(ctx->r->closer)
         dill_cancel(ctx->r->closer, 0);
@@ -328,28 +731,48 @@ static void dill_cr_close(struct hvfs *vfs) {
         int rc = dill_wait();
         dill_assert(rc == -1 && errno == 0);
     }
-#if defined DILL_CENSUS
-    /* Find first overwritten byte on the stack.
-       Determine stack usage based on that. */
-    uint8_t *bottom = ((uint8_t*)cr) - cr->stacksz;
-    int i;
-    for(i = 0; i != cr->stacksz; ++i) {
-        if(bottom[i] != 0xa0 + (i % 13)) {
-            /* dill_cr is located on stack so we have take that to account.
-               Also, it may be necessary to align the top of the stack to
-               16-byte boundary, so add 16 bytes to account for that. */
-            size_t used = cr->stacksz - i - sizeof(struct dill_cr) + 16;
-            if(used > cr->census->max_stack)
-                cr->census->max_stack = used;
-            break;
-        }
+#if defined DILL_SHARED_STACK
+    /* Shared-stack coroutines have no stack of their own. */
+    if(cr->shared) {
+        dill_shared_term(ctx, cr);
+        return;
     }
 #endif
+#if defined DILL_CENSUS
+    dill_census_record(cr);
+#endif
 #if defined DILL_VALGRIND
     VALGRIND_STACK_DEREGISTER(cr->sid);
 #endif
     /* Now that the coroutine is finished deallocate it. */
-    if(!cr->mem) dill_freestack(cr + 1);
+    if(!cr->mem) dill_freestack(cr + 1, cr->stacksz, cr->stackflags);
+}
+
+int stackcensus(struct stackcensus *items, int nitems) {
+    if(dill_slow(nitems < 0 || (nitems > 0 && !items))) {
+        errno = EINVAL; return -1;}
+#if defined DILL_CENSUS
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    int n = 0;
+    int i;
+    for(i = 0; i != DILL_CENSUS_BUCKETS && n < nitems; ++i) {
+        struct dill_slist *it;
+        for(it = dill_slist_next(&ctx->census[i]);
+              it != &ctx->census[i] && n < nitems; it = dill_slist_next(it)) {
+            struct dill_census_item *ci =
+                dill_cont(it, struct dill_census_item, item);
+            items[n].file = ci->file;
+            items[n].line = ci->line;
+            items[n].count = ci->count;
+            items[n].maxstack = ci->max_stack;
+            ++n;
+        }
+    }
+    return ctx->ncensus;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
 }
 
 /******************************************************************************/
@@ -359,7 +782,8 @@ static void dill_cr_close(struct hvfs *vfs) {
 void dill_waitfor(struct dill_clause *cl, int id, struct dill_list *before) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     /* Add the clause to the endpoint's list of waiting clauses. */
-    dill_list_insert(&cl->epitem, before);
+    if(before) dill_list_insert(&cl->epitem, before);
+    cl->cancel = NULL;
     /* Add clause to the coroutine list of active clauses. */
     cl->cr = ctx->r;
     dill_slist_push(&ctx->r->clauses, &cl->item);
@@ -371,20 +795,26 @@ int dill_wait(void)  {
        once in a while. The external signal may very well be a deadline or
        a user-issued command that cancels the CPU intensive operation. */
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
-    /* 103 is a prime. That way it's less likely to coincide with some kind
-       of cycle in the user's code. */
-    if(ctx->wait_counter >= 103) {
+    if(ctx->wait_counter >= ctx->wait_interval) {
         dill_poller_wait(0);
+        ++ctx->fairpolls;
         ctx->wait_counter = 0;
     }
     /* Store the context of the current coroutine, if any. */
     if(ctx->r) {
+        /* Stacks without guard pages are checked for overflow each time
+           the coroutine is suspended. */
+        if(dill_slow(ctx->r->stackflags & DILL_STACK_CANARY))
+            dill_stack_check(ctx->r + 1, ctx->r->stacksz);
         if(dill_setjmp(ctx->r->ctx)) {
             /* We get here once the coroutine is resumed. */
             dill_slist_init(&ctx->r->clauses);
             errno = ctx->r->err;
             return ctx->r->id;
         }
+#if defined DILL_SHARED_STACK
+        if(dill_slow(ctx->r->shared)) dill_shared_leave(ctx->r);
+#endif
     }
     while(1) {
         /* If there's a coroutine ready to be executed jump to it. */
@@ -393,6 +823,11 @@ int dill_wait(void)  {
             struct dill_slist *it = dill_qlist_pop(&ctx->ready);
             it->next = NULL;
             ctx->r = dill_cont(it, struct dill_cr, ready);
+#if defined DILL_SHARED_STACK
+            /* Shared stack may be occupied by a different coroutine. */
+            if(dill_slow(ctx->r->shared && ctx->r != ctx->shared.owner))
+                dill_shared_jump(ctx, ctx->r);
+#endif
             dill_longjmp(ctx->r->ctx);
         }
         /* Otherwise, we are going to wait for sleeping coroutines
@@ -405,20 +840,35 @@ int dill_wait(void)  {
     }
 }
 
-static void dill_docancel(struct dill_cr *cr, int id, int err) {
-    /* Sanity check: Make sure that the coroutine was really suspended. */
-    dill_assert(!cr->ready.next);
-    /* Remove the clauses from endpoints' lists of waiting coroutines. */
+/* Remove the clauses from endpoints' lists of waiting coroutines. */
+static void dill_clauses_cancel(struct dill_cr *cr) {
     struct dill_slist *it;
     for(it = dill_slist_next(&cr->clauses); it != &cr->clauses;
           it = dill_slist_next(it)) {
         struct dill_clause *cl = dill_cont(it, struct dill_clause, item);
-        dill_list_erase(&cl->epitem);
+        if(cl->cancel)
+            cl->cancel(cl);
+        else
+            dill_list_erase(&cl->epitem);
     }
+}
+
+static void dill_docancel(struct dill_cr *cr, int id, int err) {
+    /* Sanity check: Make sure that the coroutine was really suspended. */
+    dill_assert(!cr->ready.next);
+    dill_clauses_cancel(cr);
     /* Schedule the newly unblocked coroutine for execution. */
     dill_resume(cr, id, err);
 }
 
+void dill_unwait(void) {
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    int err = errno;
+    dill_clauses_cancel(ctx->r);
+    dill_slist_init(&ctx->r->clauses);
+    errno = err;
+}
+
 void dill_trigger(struct dill_clause *cl, int err) {
     dill_docancel(cl->cr, cl->id, err);
 }
@@ -30,6 +30,22 @@
 #include "qlist.h"
 #include "slist.h"
 
+#if defined DILL_TIMER_WHEEL
+#include "wheel.h"
+#else
+#include "heap.h"
+#endif
+
+/* Shared stack is supported only on microarchitectures where DILL_SETSP
+   can move the stack pointer anywhere. Elsewhere, go_shared() launches
+   an ordinary coroutine. */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined DILL_ARCH_FALLBACK
+#define DILL_SHARED_STACK
+#endif
+
+/* Number of buckets in the hash table of census items. */
+#define DILL_CENSUS_BUCKETS 64
+
 /* The coroutine. The memory layout looks like this:
    +-------------------------------------------------------------+---------+
    |                                                      stack  | dill_cr |
@@ -62,9 +78,23 @@ struct dill_cr {
     unsigned int done : 1;
     /* If true, the coroutine was launched via go_mem. */
     unsigned int mem : 1;
+    /* If true, the coroutine was launched via go_shared. */
+    unsigned int shared : 1;
     /* When coroutine handle is being closed, this is the pointer to the
        coroutine that is doing the hclose() call. */
     struct dill_cr *closer;
+    /* Size of the stack, including this structure. */
+    size_t stacksz;
+    /* Stack flags as returned by dill_allocstack(). */
+    int stackflags;
+    /* Coroutines running on the shared stack only. The part of the shared
+       stack used by the coroutine spans from sp to top. While other
+       coroutine is using the shared stack, the content is kept in buf. */
+    uint8_t *top;
+    uint8_t *sp;
+    void *buf;
+    size_t len;
+    size_t cap;
 #if defined DILL_VALGRIND
     /* Valgrind stack identifier. This way valgrind knows which areas of
        memory are used as a stacks and doesn't produce spurious warnings.
@@ -75,7 +105,6 @@ struct dill_cr {
 #if defined DILL_CENSUS
     /* Census record corresponding to this coroutine. */
     struct dill_census_item *census;
-    size_t stacksz;
 #endif
 /* Clang assumes that the client stack is aligned to 16-bytes on x86-64
    architectures; to achieve this we align this structure (with the added
@@ -87,15 +116,55 @@ struct dill_ctx_cr {
     struct dill_cr *r;
     /* List of coroutines ready for execution. */
     struct dill_qlist ready;
-    /* Global linked list of all timers. The list is ordered.
-       First timer to be resumed comes first and so on. */
-    struct dill_list timers;
+    /* All active timers. By default they are kept in a heap with the first
+       timer to be resumed on the top. Alternatively, a timing wheel can be
+       used. */
+#if defined DILL_TIMER_WHEEL
+    struct dill_wheel timers;
+#else
+    struct dill_heap timers;
+#endif
+    /* Number of context switches since external events were last checked
+       and the number of switches after which they are checked again. */
     int wait_counter;
+    int wait_interval;
+    /* Number of non-blocking polls done because of the above. */
+    uint64_t fairpolls;
+    /* For how long, in nanoseconds, to poll without blocking before going
+       to sleep. 0 means no spinning. */
+    int64_t spin;
+    /* SO_BUSY_POLL value, in microseconds, to set on sockets, 0 if none. */
+    int busypoll;
+    /* Spinning statistics. */
+    uint64_t spins;
+    uint64_t spinhits;
+    int64_t spintime;
     /* Main coroutine. We don't control creation of main coroutine's stack
        so we have to store this info here instead on the top of the stack. */
     struct dill_cr main;
+    /* The stack shared by coroutines launched via go_shared. It is allocated
+       when the first such coroutine is launched and deallocated when
+       the last one is closed. */
+    struct dill_shared {
+        uint8_t *top;
+        size_t size;
+        int flags;
+        /* Number of shared-stack coroutines. */
+        int count;
+        /* Coroutine whose content is currently on the shared stack. */
+        struct dill_cr *owner;
+        /* Small stack used while the shared stack is being overwritten. */
+        void *sw;
+        uint8_t *swtop;
+#if defined DILL_VALGRIND
+        int sid;
+        int swsid;
+#endif
+    } shared;
 #if defined DILL_CENSUS
-    struct dill_slist census;
+    /* Census items, hashed by go() call site. */
+    struct dill_slist census[DILL_CENSUS_BUCKETS];
+    int ncensus;
 #endif
 };
 
@@ -104,11 +173,14 @@ struct dill_clause {
     struct dill_cr *cr;
     /* List of clauses coroutine is waiting for. See dill_cr::clauses. */
     struct dill_slist item;
-    /* These two fields are completely opaque to the coroutine. They are meant
-       to be used by endpoints. The only thing coroutine does with it is, just
-       before dill_wait() exits, it removes 'epitem' from 'eplist' for each
-       clause. 'eplist' can be NULL in which case removal doesn't happen. */
+    /* This field is completely opaque to the coroutine. It is meant to be
+       used by endpoints. The only thing coroutine does with it is, just
+       before dill_wait() exits, it removes 'epitem' from the endpoint's list
+       for each clause. */
     struct dill_list epitem;
+    /* If set, it is called instead of removing 'epitem' from the endpoint's
+       list when the clause is canceled. */
+    void (*cancel)(struct dill_clause *cl);
     /* Number to return from dill_wait() if this clause triggers. */
     int id;
 };
@@ -116,7 +188,11 @@ struct dill_clause {
 /* Timer clause. */
 struct dill_tmcl {
     struct dill_clause cl;
-    int64_t deadline;
+#if defined DILL_TIMER_WHEEL
+    struct dill_wheel_item item;
+#else
+    struct dill_heap_item item;
+#endif
 };
 
 int dill_ctx_cr_init(struct dill_ctx_cr *ctx);
@@ -125,7 +201,9 @@ void dill_ctx_cr_term(struct dill_ctx_cr *ctx);
 /* When dill_wait() is called next time, the coroutine will wait
    (among other clauses) for this clause. 'id' must not be negative.
    'before' indicates where to insert the clause into the list of waiting
-   endpoints. Call to dill_wait() will remove the clause from the list. */
+   endpoints. Call to dill_wait() will remove the clause from the list.
+   If 'before' is NULL the clause is not inserted into any list and the caller
+   is expected to set 'cancel' afterwards. */
 void dill_waitfor(struct dill_clause *cl, int id, struct dill_list *before);
 
 /* Suspend running coroutine. Move to executing different coroutines.
@@ -136,12 +214,17 @@ void dill_waitfor(struct dill_clause *cl, int id, struct dill_list *before);
    success or non-zero value to indicate error. */
 int dill_wait(void);
 
+/* Cancels all the clauses added by dill_waitfor() without suspending
+   the coroutine. To be used if an error occurs before dill_wait() is called.
+   Preserves errno. */
+void dill_unwait(void);
+
 /* Schedule previously suspended coroutine for execution. Keep in mind that it
    doesn't immediately run it, just put it into the queue of ready coroutines.
    It will cause dill_wait() return the id supplied in dill_waitfor(). */
 void dill_trigger(struct dill_clause *cl, int err);
 
-/* Add timer to the list of active clauses. */
+/* Add timer to the list of active clauses. Deadline is in nanoseconds. */
 void dill_timer(struct dill_tmcl *tmcl, int id, int64_t deadline);
 
 /* Wait for in event on a file descriptor. */
@@ -160,6 +243,33 @@ int dill_no_blocking2(int val);
 /* Cleans cached info about the fd. */
 void dill_clean(int fd);
 
+#if defined DILL_SHARED_STACK
+
+/* Coroutines launched via go_shared() are swapped out of the shared stack
+   while they wait. Clauses, or anything else that other coroutines, threads
+   or the kernel may access in the meantime, can't live on their stack.
+   dill_clalloc() returns 'local' in ordinary coroutines and a heap block of
+   'sz' bytes in shared-stack ones. Returns NULL and sets errno to ENOMEM if
+   out of memory. dill_clfree() releases the memory. */
+void *dill_clalloc(void *local, size_t sz);
+void dill_clfree(void *local, void *mem);
+
+/* Returns the address at which the object at 'ptr', possibly on the stack of
+   waiting coroutine 'cr', can be accessed at the moment. */
+void *dill_craddr(struct dill_cr *cr, void *ptr);
+
+/* Returns 1 if the running coroutine is on the shared stack. */
+int dill_inshared(void);
+
+#else
+
+#define dill_clalloc(local, sz) ((void*)(local))
+#define dill_clfree(local, mem) ((void)0)
+#define dill_craddr(cr, ptr) ((void*)(ptr))
+#define dill_inshared() 0
+
+#endif
+
 #endif
 
 
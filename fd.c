@@ -22,6 +22,9 @@
 
 */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/param.h>
 #include <sys/resource.h>
 
@@ -46,3 +49,52 @@ int dill_maxfds(void) {
     return maxfds;
 }
 
+/* Size of a chunk of fd table entries. */
+#define DILL_FDTAB_CHUNK 4096
+
+void dill_fdtab_init(struct dill_fdtab *self, size_t elemsz,
+      void (*init)(void *elem)) {
+    self->chunks = NULL;
+    self->nchunks = 0;
+    self->elemsz = elemsz;
+    self->shift = 0;
+    while((elemsz << (self->shift + 1)) <= DILL_FDTAB_CHUNK) ++self->shift;
+    self->init = init;
+}
+
+void dill_fdtab_term(struct dill_fdtab *self) {
+    size_t i;
+    for(i = 0; i != self->nchunks; ++i)
+        free(self->chunks[i]);
+    free(self->chunks);
+    self->chunks = NULL;
+    self->nchunks = 0;
+}
+
+void *dill_fdtab_alloc(struct dill_fdtab *self, int fd) {
+    dill_assert(fd >= 0);
+    size_t i = (size_t)fd >> self->shift;
+    /* Grow the top-level array, at least twice to keep it amortized O(1). */
+    if(i >= self->nchunks) {
+        size_t n = self->nchunks ? self->nchunks * 2 : 16;
+        if(n <= i) n = i + 1;
+        char **chunks = realloc(self->chunks, n * sizeof(char*));
+        if(dill_slow(!chunks)) {errno = ENOMEM; return NULL;}
+        memset(chunks + self->nchunks, 0,
+            (n - self->nchunks) * sizeof(char*));
+        self->chunks = chunks;
+        self->nchunks = n;
+    }
+    if(!self->chunks[i]) {
+        size_t count = (size_t)1 << self->shift;
+        char *chunk = calloc(count, self->elemsz);
+        if(dill_slow(!chunk)) {errno = ENOMEM; return NULL;}
+        if(self->init) {
+            size_t j;
+            for(j = 0; j != count; ++j)
+                self->init(chunk + j * self->elemsz);
+        }
+        self->chunks[i] = chunk;
+    }
+    return dill_fdtab_find(self, fd);
+}
@@ -25,7 +25,47 @@
 #ifndef DILL_FD_INCLUDED
 #define DILL_FD_INCLUDED
 
+#include <stddef.h>
+
+#include "utils.h"
+
 /* Returns maximum possible number of file descriptors. */
 int dill_maxfds(void);
 
+/* Table of per-fd info indexed by file descriptor. Entries are allocated in
+   page-sized chunks on first use so that the memory used tracks the highest
+   fd in use rather than the limit on the number of fds. New entries are
+   zero-filled, or set up by 'init' if it is supplied. Entries never move. */
+struct dill_fdtab {
+    char **chunks;
+    size_t nchunks;
+    size_t elemsz;
+    /* Each chunk holds 1 << shift entries. */
+    int shift;
+    void (*init)(void *elem);
+};
+
+void dill_fdtab_init(struct dill_fdtab *self, size_t elemsz,
+    void (*init)(void *elem));
+void dill_fdtab_term(struct dill_fdtab *self);
+
+/* Allocates the chunk holding the entry for the fd. Returns NULL and sets
+   errno to ENOMEM if out of memory. */
+void *dill_fdtab_alloc(struct dill_fdtab *self, int fd);
+
+/* Returns the entry for the fd, or NULL if it wasn't allocated yet. */
+static inline void *dill_fdtab_find(struct dill_fdtab *self, int fd) {
+    size_t i = (size_t)fd >> self->shift;
+    if(dill_slow(i >= self->nchunks || !self->chunks[i])) return NULL;
+    size_t j = (size_t)fd & (((size_t)1 << self->shift) - 1);
+    return self->chunks[i] + j * self->elemsz;
+}
+
+/* Returns the entry for the fd, allocating it if needed. */
+static inline void *dill_fdtab_get(struct dill_fdtab *self, int fd) {
+    void *elem = dill_fdtab_find(self, fd);
+    if(dill_fast(elem)) return elem;
+    return dill_fdtab_alloc(self, fd);
+}
+
 #endif
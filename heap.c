@@ -22,78 +22,115 @@
 
 */
 
-#include <errno.h>
 #include <stddef.h>
-#include <stdlib.h>
 
 #include "heap.h"
 #include "utils.h"
 
-/* Returns index of the parent. */
-#define dill_heap_parent(index) (((index) - 1) / 2)
-/* Returns index of the left child. Increment by 1 to get index of the
-   right child. */
-#define dill_heap_child(index) (2 * (index) + 1)
+/* Returns 1 if item 'a' should be popped before item 'b'. */
+static inline int dill_heap_less(struct dill_heap_item *a,
+      struct dill_heap_item *b) {
+    return a->val < b->val || (a->val == b->val && a->seq < b->seq);
+}
+
+/* Joins two heaps. The one with greater root becomes the first child of the
+   other one. Returns the root of the resulting heap. */
+static struct dill_heap_item *dill_heap_meld(struct dill_heap_item *a,
+      struct dill_heap_item *b) {
+    if(dill_heap_less(b, a)) {
+        struct dill_heap_item *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    b->next = a->child;
+    if(a->child) a->child->prev = b;
+    b->prev = a;
+    a->child = b;
+    a->next = NULL;
+    a->prev = NULL;
+    return a;
+}
+
+/* Joins a list of sibling heaps into a single heap. The standard two-pass
+   algorithm is used. It's done iteratively rather than recursively so that
+   long lists of siblings don't exhaust small coroutine stacks. */
+static struct dill_heap_item *dill_heap_merge_pairs(
+      struct dill_heap_item *first) {
+    if(!first) return NULL;
+    /* First pass: Meld pairs of siblings from left to right. Results are
+       chained in reverse order via 'prev' pointers. */
+    struct dill_heap_item *acc = NULL;
+    while(first) {
+        struct dill_heap_item *a = first;
+        struct dill_heap_item *b = a->next;
+        if(!b) {
+            a->next = NULL;
+            a->prev = acc;
+            acc = a;
+            break;
+        }
+        first = b->next;
+        a = dill_heap_meld(a, b);
+        a->prev = acc;
+        acc = a;
+    }
+    /* Second pass: Meld the results from right to left. */
+    struct dill_heap_item *res = acc;
+    acc = acc->prev;
+    res->prev = NULL;
+    while(acc) {
+        struct dill_heap_item *prev = acc->prev;
+        res = dill_heap_meld(res, acc);
+        acc = prev;
+    }
+    return res;
+}
 
 void dill_heap_init(struct dill_heap *self) {
-    self->items = NULL;
+    self->root = NULL;
     self->count = 0;
-    self->capacity = 0;
+    self->seq = 0;
 }
 
 void dill_heap_term(struct dill_heap *self) {
-    free(self->items);
+    /* The items are owned by the user. There's nothing to deallocate. */
 }
 
-int dill_heap_push(struct dill_heap *self, int64_t *val) {
-    /* Grow the heap if needed. */
-    if(dill_slow(self->count == self->capacity)) {
-        size_t capacity = self->count ? self->count * 2 : 64;
-        int64_t **items = realloc(self->items, capacity * sizeof(int64_t*));
-        if(dill_slow(!items)) {errno = ENOMEM; return -1;}
-        self->items = items;
-        self->capacity = capacity;
-    }
-    /* Insert the new item into the heap. */
-    size_t i = self->count;
+void dill_heap_push(struct dill_heap *self, struct dill_heap_item *item) {
+    item->seq = self->seq++;
+    item->child = NULL;
+    item->next = NULL;
+    item->prev = NULL;
+    self->root = self->root ? dill_heap_meld(self->root, item) : item;
     self->count++;
-    self->items[i] = val;
-    while(i) {
-        size_t p = dill_heap_parent(i);
-        int64_t *ival = self->items[i];
-        int64_t *pval = self->items[p];
-        if(*pval <= *ival) break;
-        self->items[i] = pval;
-        self->items[p] = ival;
-        i = p;
-    }
-    return 0;
 }
 
-int64_t *dill_heap_pop(struct dill_heap *self) {
-    if(dill_slow(!self->count)) return NULL;
-    int64_t *result = self->items[0];
+struct dill_heap_item *dill_heap_pop(struct dill_heap *self) {
+    struct dill_heap_item *result = self->root;
+    if(dill_slow(!result)) return NULL;
+    self->root = dill_heap_merge_pairs(result->child);
     self->count--;
-    self->items[0] = self->items[self->count];
-    size_t p = 0;
-    while(1) {
-        int64_t *pval = self->items[p];
-        size_t ch = dill_heap_child(p);
-        int64_t *chval = self->items[ch];
-        /* If there are no children we are done. */
-        if(ch >= self->count) break;
-        /* If there are two children pick the lesser one. */
-        if(ch + 1 < self->count && *self->items[ch + 1] < *chval) {
-            ch++;
-            chval = self->items[ch];
-        }
-        /* If child is greater that parent we are done. */
-        if(*pval <= *chval) break;
-        /* Swap the parent and the child. */
-        self->items[ch] = pval;
-        self->items[p] = chval;
-        p = ch;
-    }
+    result->child = NULL;
     return result;
 }
 
+void dill_heap_erase(struct dill_heap *self, struct dill_heap_item *item) {
+    if(item == self->root) {
+        dill_heap_pop(self);
+        return;
+    }
+    /* Unlink the item from its parent and its siblings. */
+    if(item->prev->child == item)
+        item->prev->child = item->next;
+    else
+        item->prev->next = item->next;
+    if(item->next) item->next->prev = item->prev;
+    /* Children of the removed item are merged back into the heap. */
+    struct dill_heap_item *sub = dill_heap_merge_pairs(item->child);
+    if(sub) self->root = dill_heap_meld(self->root, sub);
+    self->count--;
+    item->child = NULL;
+    item->next = NULL;
+    item->prev = NULL;
+}
+
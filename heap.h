@@ -25,18 +25,52 @@
 #ifndef DILL_HEAP_INCLUDED
 #define DILL_HEAP_INCLUDED
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Intrusive pairing heap. Items are ordered by 'val', items with equal
+   values are ordered in the order they were pushed to the heap. Push is O(1),
+   pop and erase are O(log n) amortized. The heap never allocates memory,
+   so none of the operations can fail. */
+
+struct dill_heap_item {
+    /* The key the heap is ordered by. Set it before pushing the item. */
+    int64_t val;
+    /* Sequence number. Used to keep items with equal values in FIFO order. */
+    uint64_t seq;
+    /* First child of the item. */
+    struct dill_heap_item *child;
+    /* Next sibling. */
+    struct dill_heap_item *next;
+    /* Previous sibling or, for the first child, the parent. */
+    struct dill_heap_item *prev;
+};
+
 struct dill_heap {
-    int64_t **items;
+    struct dill_heap_item *root;
     size_t count;
-    size_t capacity;
+    uint64_t seq;
 };
 
 void dill_heap_init(struct dill_heap *self);
 void dill_heap_term(struct dill_heap *self);
-int dill_heap_push(struct dill_heap *self, int64_t *val);
-int64_t *dill_heap_pop(struct dill_heap *self);
+
+/* True if the heap has no items. */
+static inline int dill_heap_empty(struct dill_heap *self) {
+    return !self->root;
+}
+
+/* Returns the item with the lowest value without removing it from the heap.
+   Returns NULL if the heap is empty. */
+static inline struct dill_heap_item *dill_heap_top(struct dill_heap *self) {
+    return self->root;
+}
+
+void dill_heap_push(struct dill_heap *self, struct dill_heap_item *item);
+struct dill_heap_item *dill_heap_pop(struct dill_heap *self);
+
+/* Removes an arbitrary item from the heap. */
+void dill_heap_erase(struct dill_heap *self, struct dill_heap_item *item);
 
 #endif
 
@@ -21,88 +21,208 @@
 */
 
 #include <stdint.h>
-#include <sys/time.h>
-#include <time.h>
-
-#if defined __APPLE__
-#include <mach/mach_time.h>
-#endif
 
 #include "cr.h"
+#include "fd.h"
 #include "libdill.h"
+#include "now.h"
+#include "pollset.h"
 #include "utils.h"
 
-int64_t now(void) {
-#if defined __APPLE__
-    static mach_timebase_info_data_t dill_mtid = {0};
-    if (dill_slow(!dill_mtid.denom))
-        mach_timebase_info(&dill_mtid);
-    uint64_t ticks = mach_absolute_time();
-    return (int64_t)(ticks * dill_mtid.numer / dill_mtid.denom / 1000000);
-#elif defined CLOCK_MONOTONIC
-    struct timespec ts;
-    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
-    dill_assert (rc == 0);
-    return ((int64_t)ts.tv_sec) * 1000 + (((int64_t)ts.tv_nsec) / 1000000);
-#else
-    /* This is slow and error-prone (time can jump backwards!) but it's just
-       a last resort option. */
-    struct timeval tv;
-    int rc = gettimeofday(&tv, NULL);
-    assert(rc == 0);
-    return ((int64_t)tv.tv_sec) * 1000 + (((int64_t)tv.tv_usec) / 1000);
-#endif
-}
+/* Clauses used by fdin() and fdout(). */
+struct dill_fdwait {
+    struct dill_clause fdcl;
+    struct dill_tmcl tmcl;
+};
 
-int msleep(int64_t deadline) {
+int nsleep(int64_t deadline) {
     /* Return ECANCELED if shutting down. */
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
     /* Actual waiting. */
-    struct dill_tmcl tmcl;
-    dill_timer(&tmcl, 1, deadline);
+    struct dill_tmcl tmcl_, *tmcl = dill_clalloc(&tmcl_, sizeof(tmcl_));
+    if(dill_slow(!tmcl)) return -1;
+    dill_timer(tmcl, 1, deadline);
     int id = dill_wait();
+    dill_clfree(&tmcl_, tmcl);
     if(dill_slow(id < 0)) return -1;
     return 0;
 }
 
-int fdin(int fd, int64_t deadline) {
+int msleep(int64_t deadline) {
+    return nsleep(dill_ms2ns(deadline));
+}
+
+int fdin_ns(int fd, int64_t deadline) {
     /* Return ECANCELED if shutting down. */
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
+    struct dill_fdwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+    if(dill_slow(!wt)) return -1;
     /* Start waiting for the fd. */
-    struct dill_clause fdcl;
-    rc = dill_in(&fdcl, 1, fd);
-    if(dill_slow(rc < 0)) return -1;
+    rc = dill_in(&wt->fdcl, 1, fd);
+    if(dill_slow(rc < 0)) {dill_clfree(&wt_, wt); return -1;}
     /* Optionally, start waiting for a timer. */
-    struct dill_tmcl tmcl;
-    dill_timer(&tmcl, 2, deadline);
+    dill_timer(&wt->tmcl, 2, deadline);
     /* Block. */
     int id = dill_wait();
+    dill_clfree(&wt_, wt);
     if(dill_slow(id < 0)) return -1;
     if(dill_slow(id == 2)) {errno = ETIMEDOUT; return -1;}
     return 0;
 }
 
-int fdout(int fd, int64_t deadline) {
+int fdin(int fd, int64_t deadline) {
+    return fdin_ns(fd, dill_ms2ns(deadline));
+}
+
+int fdout_ns(int fd, int64_t deadline) {
     /* Return ECANCELED if shutting down. */
     int rc = dill_canblock();
     if(dill_slow(rc < 0)) return -1;
+    struct dill_fdwait wt_, *wt = dill_clalloc(&wt_, sizeof(wt_));
+    if(dill_slow(!wt)) return -1;
     /* Start waiting for the fd. */
-    struct dill_clause fdcl;
-    rc = dill_out(&fdcl, 1, fd);
-    if(dill_slow(rc < 0)) return -1;
+    rc = dill_out(&wt->fdcl, 1, fd);
+    if(dill_slow(rc < 0)) {dill_clfree(&wt_, wt); return -1;}
     /* Optionally, start waiting for a timer. */
-    struct dill_tmcl tmcl;
-    dill_timer(&tmcl, 2, deadline);
+    dill_timer(&wt->tmcl, 2, deadline);
     /* Block. */
     int id = dill_wait();
+    dill_clfree(&wt_, wt);
     if(dill_slow(id < 0)) return -1;
     if(dill_slow(id == 2)) {errno = ETIMEDOUT; return -1;}
     return 0;
 }
 
+int fdout(int fd, int64_t deadline) {
+    return fdout_ns(fd, dill_ms2ns(deadline));
+}
+
+/* Does the I/O operation using a syscall. Returns -1 and sets errno to EAGAIN
+   if it would block. */
+static ssize_t dill_fdsyscall(int op, int fd, void *buf, size_t len,
+      void *arg) {
+    switch(op) {
+    case DILL_IOREAD:
+        return read(fd, buf, len);
+    case DILL_IOWRITE:
+        return write(fd, buf, len);
+    case DILL_IOREADV:
+        return readv(fd, buf, (int)len);
+    case DILL_IOWRITEV:
+        return writev(fd, buf, (int)len);
+    case DILL_IOACCEPT:
+        return accept(fd, buf, arg);
+    default:
+        dill_assert(0);
+    }
+}
+
+static ssize_t dill_fdio(int op, int fd, void *buf, size_t len, void *arg,
+      int64_t deadline) {
+    /* Return ECANCELED if shutting down. */
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(fd < 0)) {errno = EBADF; return -1;}
+    /* If possible, let the kernel do the operation and wait for
+       the completion. */
+    struct dill_iocl io;
+    /* The kernel would write to the buffer while a shared-stack coroutine
+       is swapped out. Such coroutines wait for readiness instead. */
+    if(dill_slow(dill_inshared())) {
+        errno = ENOTSUP;
+        rc = -1;
+    }
+    else
+        rc = dill_pollset_io(&io, 1, op, fd, buf, len, arg);
+    if(dill_fast(rc == 0)) {
+        /* Optionally, start waiting for a timer. */
+        struct dill_tmcl tmcl;
+        dill_timer(&tmcl, 2, deadline);
+        /* Block. */
+        int id = dill_wait();
+        if(dill_slow(id != 1)) {
+            int err = id == 2 ? ETIMEDOUT : errno;
+            dill_pollset_iocancel(&io);
+            /* If the operation succeeded in the meantime, don't lose
+               the data. */
+            if(io.res < 0) {errno = err; return -1;}
+        }
+        if(dill_slow(io.res < 0)) {errno = -io.res; return -1;}
+        return io.res;
+    }
+    if(dill_slow(errno != ENOTSUP)) return -1;
+    /* Otherwise, wait for the fd to become ready and do the syscall. */
+    while(1) {
+        ssize_t sz = dill_fdsyscall(op, fd, buf, len, arg);
+        if(sz >= 0) return sz;
+        if(errno == EINTR) continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if(op == DILL_IOWRITE || op == DILL_IOWRITEV)
+            rc = fdout_ns(fd, deadline);
+        else
+            rc = fdin_ns(fd, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+}
+
+ssize_t fdread_ns(int fd, void *buf, size_t len, int64_t deadline) {
+    return dill_fdio(DILL_IOREAD, fd, buf, len, NULL, deadline);
+}
+
+ssize_t fdread(int fd, void *buf, size_t len, int64_t deadline) {
+    return fdread_ns(fd, buf, len, dill_ms2ns(deadline));
+}
+
+ssize_t fdwrite_ns(int fd, const void *buf, size_t len, int64_t deadline) {
+    return dill_fdio(DILL_IOWRITE, fd, (void*)buf, len, NULL, deadline);
+}
+
+ssize_t fdwrite(int fd, const void *buf, size_t len, int64_t deadline) {
+    return fdwrite_ns(fd, buf, len, dill_ms2ns(deadline));
+}
+
+ssize_t fdreadv_ns(int fd, const struct iovec *iov, int iovcnt,
+      int64_t deadline) {
+    if(dill_slow(iovcnt < 0)) {errno = EINVAL; return -1;}
+    return dill_fdio(DILL_IOREADV, fd, (void*)iov, iovcnt, NULL, deadline);
+}
+
+ssize_t fdreadv(int fd, const struct iovec *iov, int iovcnt,
+      int64_t deadline) {
+    return fdreadv_ns(fd, iov, iovcnt, dill_ms2ns(deadline));
+}
+
+ssize_t fdwritev_ns(int fd, const struct iovec *iov, int iovcnt,
+      int64_t deadline) {
+    if(dill_slow(iovcnt < 0)) {errno = EINVAL; return -1;}
+    return dill_fdio(DILL_IOWRITEV, fd, (void*)iov, iovcnt, NULL, deadline);
+}
+
+ssize_t fdwritev(int fd, const struct iovec *iov, int iovcnt,
+      int64_t deadline) {
+    return fdwritev_ns(fd, iov, iovcnt, dill_ms2ns(deadline));
+}
+
+int fdaccept_ns(int fd, struct sockaddr *addr, socklen_t *addrlen,
+      int64_t deadline) {
+    return (int)dill_fdio(DILL_IOACCEPT, fd, addr, 0, addrlen, deadline);
+}
+
+int fdaccept(int fd, struct sockaddr *addr, socklen_t *addrlen,
+      int64_t deadline) {
+    return fdaccept_ns(fd, addr, addrlen, dill_ms2ns(deadline));
+}
+
 void fdclean(int fd) {
     dill_clean(fd);
 }
 
+int fdpolicy(int fd, int policy) {
+    if(dill_slow(fd < 0 || fd >= dill_maxfds())) {errno = EBADF; return -1;}
+    if(dill_slow(policy != FDWAKEONE && policy != FDWAKEALL)) {
+        errno = EINVAL; return -1;}
+    return dill_pollset_policy(fd, policy == FDWAKEALL);
+}
+
@@ -31,6 +31,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #if defined __linux__
 #include <alloca.h>
@@ -46,7 +48,7 @@
 /*  www.gnu.org/software/libtool/manual/html_node/Updating-version-info.html  */
 
 /*  The current interface version. */
-#define DILL_VERSION_CURRENT 10
+#define DILL_VERSION_CURRENT 11
 
 /*  The latest revision of the current interface. */
 #define DILL_VERSION_REVISION 0
@@ -79,6 +81,8 @@
 /******************************************************************************/
 
 DILL_EXPORT int64_t now(void);
+DILL_EXPORT int64_t now_coarse(void);
+DILL_EXPORT int64_t now_ns(void);
 
 /******************************************************************************/
 /*  Handles                                                                   */
@@ -107,6 +111,9 @@ DILL_EXPORT extern volatile void *dill_unoptimisable;
 DILL_EXPORT __attribute__((noinline)) int dill_prologue(sigjmp_buf **ctx,
     void **ptr, size_t len, const char *file, int line);
 DILL_EXPORT __attribute__((noinline)) void dill_epilogue(void);
+DILL_EXPORT __attribute__((noinline)) int dill_prologue_shared(
+    sigjmp_buf **ctx, void **ptr, const char *file, int line);
+DILL_EXPORT __attribute__((noinline)) void dill_shared_enter(void);
 
 /* In the following macros alloca(sizeof(size_t)) is used because clang
    doesn't support alloca with size zero. */
@@ -225,12 +232,110 @@ DILL_EXPORT __attribute__((noinline)) void dill_epilogue(void);
     })
 
 #define go(fn) go_mem(fn, NULL, 0)
+#define go_stack(fn, len) go_mem(fn, NULL, (len))
+
+/* The coroutine runs on the stack shared by all such coroutines in the
+   thread. The parent's part of the shared stack, if any, is saved before
+   the new coroutine starts. */
+#define go_shared(fn) \
+    ({\
+        sigjmp_buf *ctx;\
+        void *stk = NULL;\
+        int h = dill_prologue_shared(&ctx, &stk, __FILE__, __LINE__);\
+        if(h >= 0) {\
+            if(!dill_setjmp(*ctx)) {\
+                dill_shared_enter();\
+                DILL_SETSP(stk);\
+                fn;\
+                dill_epilogue();\
+            }\
+        }\
+        h;\
+    })
+
+DILL_EXPORT int stacksize(size_t size);
+DILL_EXPORT int stackcache(int count);
+
+#define STACKARENAOFF 0
+#define STACKARENAGUARD 1
+#define STACKARENACANARY 2
+
+DILL_EXPORT int stackarena(int mode);
+
+#define STACKTRIMLAZY 1
+
+DILL_EXPORT int stacktrim(int high, int low, int flags);
+
+struct stackstats {
+    uint64_t allocs;
+    uint64_t hits;
+    uint64_t refills;
+    uint64_t refillmisses;
+    uint64_t spills;
+    uint64_t spillmisses;
+};
+
+DILL_EXPORT int stackstats(struct stackstats *stats);
+
+struct stackcensus {
+    const char *file;
+    int line;
+    uint64_t count;
+    size_t maxstack;
+};
+
+DILL_EXPORT int stackcensus(struct stackcensus *items, int nitems);
 
 DILL_EXPORT int yield(void);
 DILL_EXPORT int msleep(int64_t deadline);
+DILL_EXPORT int nsleep(int64_t deadline);
+
+struct pollstats {
+    uint64_t polls;
+    uint64_t events;
+    uint64_t fullpolls;
+    uint64_t fairpolls;
+    int batch;
+    uint64_t spins;
+    uint64_t spinhits;
+    int64_t spintime;
+};
+
+#define POLLSPINSOCK 1
+
+DILL_EXPORT int pollbatch(int size);
+DILL_EXPORT int pollinterval(int switches);
+DILL_EXPORT int pollspin(int usecs, int flags);
+DILL_EXPORT int pollstats(struct pollstats *stats);
 DILL_EXPORT void fdclean(int fd);
+
+#define FDWAKEONE 0
+#define FDWAKEALL 1
+
+DILL_EXPORT int fdpolicy(int fd, int policy);
 DILL_EXPORT int fdin(int fd, int64_t deadline);
+DILL_EXPORT int fdin_ns(int fd, int64_t deadline);
 DILL_EXPORT int fdout(int fd, int64_t deadline);
+DILL_EXPORT int fdout_ns(int fd, int64_t deadline);
+DILL_EXPORT ssize_t fdread(int fd, void *buf, size_t len, int64_t deadline);
+DILL_EXPORT ssize_t fdread_ns(int fd, void *buf, size_t len,
+    int64_t deadline);
+DILL_EXPORT ssize_t fdwrite(int fd, const void *buf, size_t len,
+    int64_t deadline);
+DILL_EXPORT ssize_t fdwrite_ns(int fd, const void *buf, size_t len,
+    int64_t deadline);
+DILL_EXPORT ssize_t fdreadv(int fd, const struct iovec *iov, int iovcnt,
+    int64_t deadline);
+DILL_EXPORT ssize_t fdreadv_ns(int fd, const struct iovec *iov, int iovcnt,
+    int64_t deadline);
+DILL_EXPORT ssize_t fdwritev(int fd, const struct iovec *iov, int iovcnt,
+    int64_t deadline);
+DILL_EXPORT ssize_t fdwritev_ns(int fd, const struct iovec *iov, int iovcnt,
+    int64_t deadline);
+DILL_EXPORT int fdaccept(int fd, struct sockaddr *addr, socklen_t *addrlen,
+    int64_t deadline);
+DILL_EXPORT int fdaccept_ns(int fd, struct sockaddr *addr, socklen_t *addrlen,
+    int64_t deadline);
 
 /******************************************************************************/
 /*  Channels                                                                  */
@@ -238,6 +343,8 @@ DILL_EXPORT int fdout(int fd, int64_t deadline);
 
 #define CHSEND 1
 #define CHRECV 2
+#define CHFDIN 3
+#define CHFDOUT 4
 
 struct chclause {
     int op;
@@ -248,19 +355,62 @@ struct chclause {
 
 struct chmem {
 #if defined(__i386__)
-    char reserved[36];
+    char reserved[52];
 #else
-    char reserved[72];
+    char reserved[104];
 #endif
 };
 
+/* Item carried by pointer channels. */
+struct chptr {
+    void *ptr;
+    size_t len;
+};
+
 DILL_EXPORT int chmake(size_t itemsz);
 DILL_EXPORT int chmake_mem(size_t itemsz, struct chmem *mem);
+DILL_EXPORT int chmake_buf(size_t itemsz, size_t capacity);
+DILL_EXPORT int chmake_buf_mem(size_t itemsz, size_t capacity,
+    struct chmem *mem, void *buf);
 DILL_EXPORT int chsend(int ch, const void *val, size_t len, int64_t deadline);
+DILL_EXPORT int chsend_ns(int ch, const void *val, size_t len,
+    int64_t deadline);
 DILL_EXPORT int chrecv(int ch, void *val, size_t len, int64_t deadline);
+DILL_EXPORT int chrecv_ns(int ch, void *val, size_t len, int64_t deadline);
+DILL_EXPORT int chmake_ptr(void);
+DILL_EXPORT int chmake_mt(size_t itemsz, size_t capacity);
+DILL_EXPORT void *chexport(int ch);
+DILL_EXPORT int chimport(void *ref);
+DILL_EXPORT int chsend_ptr(int ch, void *ptr, size_t len, int64_t deadline);
+DILL_EXPORT int chsend_ptr_ns(int ch, void *ptr, size_t len,
+    int64_t deadline);
+DILL_EXPORT int chrecv_ptr(int ch, void **ptr, size_t *len,
+    int64_t deadline);
+DILL_EXPORT int chrecv_ptr_ns(int ch, void **ptr, size_t *len,
+    int64_t deadline);
+DILL_EXPORT ssize_t chsendv(int ch, const void *vals, size_t n,
+    int64_t deadline);
+DILL_EXPORT ssize_t chsendv_ns(int ch, const void *vals, size_t n,
+    int64_t deadline);
+DILL_EXPORT ssize_t chrecvv(int ch, void *vals, size_t n, int64_t deadline);
+DILL_EXPORT ssize_t chrecvv_ns(int ch, void *vals, size_t n,
+    int64_t deadline);
 DILL_EXPORT int chdone(int ch);
 DILL_EXPORT int choose(struct chclause *clauses, int nclauses,
     int64_t deadline);
+DILL_EXPORT int choose_ns(struct chclause *clauses, int nclauses,
+    int64_t deadline);
+
+/******************************************************************************/
+/*  Worker pools                                                              */
+/******************************************************************************/
+
+DILL_EXPORT int poolmake(int nthreads);
+DILL_EXPORT int poolgo(int pool, void (*fn)(void *arg), void *arg);
+DILL_EXPORT int poolself(void);
+DILL_EXPORT int offload(void (*fn)(void *arg), void *arg, int64_t deadline);
+DILL_EXPORT int offload_ns(void (*fn)(void *arg), void *arg,
+    int64_t deadline);
 
 #endif
 
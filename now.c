@@ -0,0 +1,117 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+#if defined __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "libdill.h"
+#include "now.h"
+#include "utils.h"
+#include "ctx.h"
+
+/* Reads the system clock. Returns time in nanoseconds. */
+static int64_t dill_mnow(void) {
+#if defined __APPLE__
+    static mach_timebase_info_data_t dill_mtid = {0};
+    if (dill_slow(!dill_mtid.denom))
+        mach_timebase_info(&dill_mtid);
+    uint64_t ticks = mach_absolute_time();
+    return (int64_t)(ticks * dill_mtid.numer / dill_mtid.denom);
+#elif defined CLOCK_MONOTONIC
+    struct timespec ts;
+    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    dill_assert (rc == 0);
+    return ((int64_t)ts.tv_sec) * 1000000000 + (int64_t)ts.tv_nsec;
+#else
+    /* This is slow and error-prone (time can jump backwards!) but it's just
+       a last resort option. */
+    struct timeval tv;
+    int rc = gettimeofday(&tv, NULL);
+    assert(rc == 0);
+    return ((int64_t)tv.tv_sec) * 1000000000 +
+        ((int64_t)tv.tv_usec) * 1000;
+#endif
+}
+
+int dill_ctx_now_init(struct dill_ctx_now *ctx) {
+    ctx->last_time = dill_mnow();
+#if defined(__x86_64__) || defined(__i386__)
+    ctx->last_tsc = __builtin_ia32_rdtsc();
+#endif
+    return 0;
+}
+
+void dill_ctx_now_term(struct dill_ctx_now *ctx) {
+}
+
+int64_t dill_now_refresh(void) {
+    struct dill_ctx_now *ctx = &dill_getctx->now;
+    ctx->last_time = dill_mnow();
+#if defined(__x86_64__) || defined(__i386__)
+    ctx->last_tsc = __builtin_ia32_rdtsc();
+#endif
+    return ctx->last_time;
+}
+
+int64_t now_ns(void) {
+    return dill_mnow();
+}
+
+int64_t dill_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    /* On x86 platforms, rdtsc instruction can be used to quickly check time
+       in form of CPU cycles. If less than 1M cycles have elapsed since the
+       last precise time check we assume the cached time is still good
+       enough and return it. 1M cycles is ~1ms on a 1GHz CPU. Absolute value
+       is used to be on the safe side if the thread migrates between CPUs. */
+    struct dill_ctx_now *ctx = &dill_getctx->now;
+    int64_t diff = (int64_t)(__builtin_ia32_rdtsc() - ctx->last_tsc);
+    if(diff < 0) diff = -diff;
+    if(dill_fast(diff < 1000000)) return ctx->last_time;
+    return dill_now_refresh();
+#elif defined CLOCK_MONOTONIC_COARSE
+    /* Coarse clock is not as precise as the monotonic clock but it is much
+       faster to read. Its resolution is typically a few milliseconds. */
+    struct timespec ts;
+    int rc = clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    dill_assert (rc == 0);
+    return ((int64_t)ts.tv_sec) * 1000000000 + (int64_t)ts.tv_nsec;
+#else
+    return dill_mnow();
+#endif
+}
+
+int64_t now(void) {
+    return dill_mnow() / 1000000;
+}
+
+int64_t now_coarse(void) {
+    return dill_now() / 1000000;
+}
+
@@ -0,0 +1,61 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef DILL_NOW_INCLUDED
+#define DILL_NOW_INCLUDED
+
+#include <stdint.h>
+
+/* Per-thread cache of the current time. It is refreshed by the poller
+   and when it gets stale. The time is stored in nanoseconds. */
+struct dill_ctx_now {
+    int64_t last_time;
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t last_tsc;
+#endif
+};
+
+int dill_ctx_now_init(struct dill_ctx_now *ctx);
+void dill_ctx_now_term(struct dill_ctx_now *ctx);
+
+/* Returns current time, in nanoseconds, possibly using the cached value.
+   The value may lag behind the precise time by a millisecond or, on some
+   platforms, by a few milliseconds. It's cheap enough to be used on the hot
+   path. */
+int64_t dill_now(void);
+
+/* Returns precise current time, in nanoseconds, and refreshes the cached
+   time. Unlike now_ns(), it requires the libdill context of the thread. */
+int64_t dill_now_refresh(void);
+
+/* Converts a deadline in milliseconds into a deadline in nanoseconds.
+   Special values 0 and -1 are preserved. */
+static inline int64_t dill_ms2ns(int64_t deadline) {
+    if(deadline <= 0) return deadline < 0 ? -1 : 0;
+    if(deadline > INT64_MAX / 1000000) return INT64_MAX;
+    return deadline * 1000000;
+}
+
+#endif
+
@@ -0,0 +1,200 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libdill.h"
+#include "now.h"
+
+#if !defined DILL_THREADS
+
+int offload_ns(void (*fn)(void *arg), void *arg, int64_t deadline) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+#else
+
+#include <pthread.h>
+
+#include "cr.h"
+#include "list.h"
+#include "pollset.h"
+#include "utils.h"
+
+/* Maximum number of threads executing the offloaded functions. */
+#ifndef DILL_OFFLOAD_THREADS
+#define DILL_OFFLOAD_THREADS 8
+#endif
+
+/* Blocking functions are executed by a process-wide pool of threads. Threads
+   are created on demand and they never exit. Once the function is done
+   the waiting coroutine is woken up via its pollset. */
+
+#define DILL_OFFLOAD_QUEUED 0
+#define DILL_OFFLOAD_RUNNING 1
+#define DILL_OFFLOAD_DONE 2
+/* The caller gave up waiting while the function was running. The worker
+   thread will deallocate the job. */
+#define DILL_OFFLOAD_ABANDONED 3
+
+struct dill_offload_job {
+    void (*fn)(void *arg);
+    void *arg;
+    /* Signaled when the function finishes. */
+    struct dill_rcl rcl;
+    /* Item in the queue of jobs. */
+    struct dill_list item;
+    int state;
+};
+
+static pthread_mutex_t dill_offload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dill_offload_cond = PTHREAD_COND_INITIALIZER;
+static struct dill_list dill_offload_queue =
+    {&dill_offload_queue, &dill_offload_queue};
+static int dill_offload_nthreads = 0;
+/* Number of threads waiting for a job. A thread that was signaled counts
+   as idle until it wakes up. */
+static int dill_offload_nidle = 0;
+/* Number of jobs in the queue. */
+static int dill_offload_nqueued = 0;
+
+static void *dill_offload_worker(void *arg) {
+    pthread_mutex_lock(&dill_offload_lock);
+    while(1) {
+        while(dill_list_empty(&dill_offload_queue)) {
+            ++dill_offload_nidle;
+            pthread_cond_wait(&dill_offload_cond, &dill_offload_lock);
+            --dill_offload_nidle;
+        }
+        struct dill_offload_job *job = dill_cont(
+            dill_list_next(&dill_offload_queue), struct dill_offload_job, item);
+        dill_list_erase(&job->item);
+        --dill_offload_nqueued;
+        job->state = DILL_OFFLOAD_RUNNING;
+        pthread_mutex_unlock(&dill_offload_lock);
+        job->fn(job->arg);
+        pthread_mutex_lock(&dill_offload_lock);
+        if(job->state == DILL_OFFLOAD_ABANDONED) {
+            free(job);
+            continue;
+        }
+        job->state = DILL_OFFLOAD_DONE;
+        /* The lock prevents the caller from deallocating the job before
+           the signal is delivered. */
+        dill_pollset_signal(&job->rcl);
+    }
+    return NULL;
+}
+
+/* Must be called with the lock held. */
+static int dill_offload_submit(struct dill_offload_job *job) {
+    dill_list_insert(&job->item, &dill_offload_queue);
+    ++dill_offload_nqueued;
+    /* Idle threads that were already signaled haven't taken their jobs
+       yet. Spawn a new thread unless there's an idle one for each job. */
+    if(dill_offload_nqueued <= dill_offload_nidle ||
+          dill_offload_nthreads >= DILL_OFFLOAD_THREADS) {
+        pthread_cond_signal(&dill_offload_cond);
+        return 0;
+    }
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, dill_offload_worker, NULL);
+    if(dill_slow(rc != 0)) {
+        /* The existing threads will get to the job eventually. */
+        if(dill_offload_nthreads > 0) {
+            pthread_cond_signal(&dill_offload_cond);
+            return 0;
+        }
+        dill_list_erase(&job->item);
+        --dill_offload_nqueued;
+        errno = rc;
+        return -1;
+    }
+    rc = pthread_detach(thread);
+    dill_assert(rc == 0);
+    ++dill_offload_nthreads;
+    return 0;
+}
+
+int offload_ns(void (*fn)(void *arg), void *arg, int64_t deadline) {
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(!fn)) {errno = EINVAL; return -1;}
+    /* The job may outlive this function if the caller gives up waiting. */
+    struct dill_offload_job *job = malloc(sizeof(struct dill_offload_job));
+    if(dill_slow(!job)) {errno = ENOMEM; return -1;}
+    job->fn = fn;
+    job->arg = arg;
+    job->state = DILL_OFFLOAD_QUEUED;
+    rc = dill_pollset_rcl(&job->rcl);
+    if(dill_slow(rc < 0)) {free(job); return -1;}
+    struct dill_tmcl tmcl_, *tmcl = dill_clalloc(&tmcl_, sizeof(tmcl_));
+    if(dill_slow(!tmcl)) {free(job); return -1;}
+    pthread_mutex_lock(&dill_offload_lock);
+    rc = dill_offload_submit(job);
+    pthread_mutex_unlock(&dill_offload_lock);
+    if(dill_slow(rc < 0)) {dill_clfree(&tmcl_, tmcl); free(job); return -1;}
+    /* Wait for the function to finish. */
+    dill_pollset_remote(&job->rcl, 1);
+    dill_timer(tmcl, 2, deadline);
+    int id = dill_wait();
+    dill_clfree(&tmcl_, tmcl);
+    int err = id == 2 ? ETIMEDOUT : errno;
+    pthread_mutex_lock(&dill_offload_lock);
+    switch(job->state) {
+    case DILL_OFFLOAD_QUEUED:
+        /* The function haven't started yet. Cancel it. */
+        dill_list_erase(&job->item);
+        --dill_offload_nqueued;
+        break;
+    case DILL_OFFLOAD_RUNNING:
+        /* The function can't be interrupted. Let it run to completion in
+           the background. */
+        job->state = DILL_OFFLOAD_ABANDONED;
+        pthread_mutex_unlock(&dill_offload_lock);
+        errno = err;
+        return -1;
+    case DILL_OFFLOAD_DONE:
+        /* The function finished even though we have timed out or were
+           canceled in the meantime. Report success anyway. */
+        err = 0;
+        break;
+    default:
+        dill_assert(0);
+    }
+    pthread_mutex_unlock(&dill_offload_lock);
+    free(job);
+    if(dill_slow(err)) {errno = err; return -1;}
+    return 0;
+}
+
+#endif
+
+int offload(void (*fn)(void *arg), void *arg, int64_t deadline) {
+    return offload_ns(fn, arg, dill_ms2ns(deadline));
+}
@@ -38,24 +38,51 @@ static coroutine void worker(int in, int out) {
     }
 }
 
+static coroutine void vworker(int in, int out, int batch) {
+    int vals[batch];
+    while(1) {
+        ssize_t n = chrecvv(in, vals, batch, -1);
+        ssize_t i = 0;
+        while(i != n)
+            i += chsendv(out, vals + i, n - i, -1);
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if(argc != 2) {
-        printf("usage: chan <millions-of-roundtrips>\n");
+    if(argc < 2 || argc > 3) {
+        printf("usage: chan <millions-of-roundtrips> [batch-size]\n");
         return 1;
     }
     long count = atol(argv[1]) * 1000000;
+    int batch = argc > 2 ? atoi(argv[2]) : 0;
 
-    int out = chmake(sizeof(int));
-    int in = chmake(sizeof(int));
+    /* In batched mode messages are passed via chsendv/chrecvv through
+       buffered channels large enough to hold one batch. */
+    int out = chmake_buf(sizeof(int), batch);
+    int in = chmake_buf(sizeof(int), batch);
 
     int64_t start = now();
-    go(worker(out, in));
-
-    int val = 0;
     long i;
-    for(i = 0; i != count; ++i) {
-        chsend(out, &val, sizeof(val), -1);
-        chrecv(in, &val, sizeof(val), -1);
+    if(batch == 0) {
+        go(worker(out, in));
+        int val = 0;
+        for(i = 0; i != count; ++i) {
+            chsend(out, &val, sizeof(val), -1);
+            chrecv(in, &val, sizeof(val), -1);
+        }
+    }
+    else {
+        go(vworker(out, in, batch));
+        int vals[batch];
+        int j;
+        for(j = 0; j != batch; ++j) vals[j] = j;
+        for(i = 0; i < count; i += batch) {
+            chsendv(out, vals, batch, -1);
+            j = 0;
+            while(j != batch)
+                j += chrecvv(in, vals + j, batch - j, -1);
+        }
+        count = i;
     }
 
     int64_t stop = now();
@@ -0,0 +1,87 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "../libdill.h"
+
+static coroutine void consumer(int ch, int done) {
+    int val;
+    while(1) {
+        int rc = chrecv(ch, &val, sizeof(val), -1);
+        if(rc == -1 && errno == EPIPE)
+            break;
+        assert(rc == 0);
+    }
+    int rc = chsend(done, NULL, 0, -1);
+    assert(rc == 0);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argc > 3) {
+        printf("usage: chanbuf <millions-of-messages> [capacity]\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000000;
+    size_t capacity = argc > 2 ? (size_t)atol(argv[2]) : 0;
+
+    int ch = chmake_buf(sizeof(int), capacity);
+    assert(ch >= 0);
+    int done = chmake(0);
+    assert(done >= 0);
+
+    int64_t start = now();
+    int h = go(consumer(ch, done));
+    assert(h >= 0);
+
+    int val = 0;
+    long i;
+    for(i = 0; i != count; ++i) {
+        int rc = chsend(ch, &val, sizeof(val), -1);
+        assert(rc == 0);
+    }
+    int rc = chdone(ch);
+    assert(rc == 0);
+    rc = chrecv(done, NULL, 0, -1);
+    assert(rc == 0);
+
+    int64_t stop = now();
+    long duration = (long)(stop - start);
+    long ns = (duration * 1000000) / count;
+
+    printf("done %ldM messages with capacity %zu in %f seconds\n",
+        (long)(count / 1000000), capacity, ((float)duration) / 1000);
+    printf("duration of passing a single message: %ld ns\n", ns);
+    printf("messages per second: %fM\n",
+        (float)(1000000000 / (ns ? ns : 1)) / 1000000);
+
+    hclose(h);
+    hclose(done);
+    hclose(ch);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libdill.h"
+
+static coroutine void copier(int ch, size_t sz) {
+    char *buf = malloc(sz);
+    assert(buf);
+    while(1) {
+        int rc = chrecv(ch, buf, sz, -1);
+        if(rc < 0) break;
+    }
+    free(buf);
+}
+
+static coroutine void borrower(int ch) {
+    while(1) {
+        void *ptr;
+        size_t len;
+        int rc = chrecv_ptr(ch, &ptr, &len, -1);
+        if(rc < 0) break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: chanptr <thousands-of-messages>\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000;
+
+    size_t sizes[] = {64, 256, 1024, 4096, 16384, 65536};
+    char *buf = malloc(sizes[5]);
+    assert(buf);
+    memset(buf, 0, sizes[5]);
+
+    printf("%10s %16s %16s\n", "size", "copy [ns/msg]", "pointer [ns/msg]");
+    int i;
+    for(i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        size_t sz = sizes[i];
+        long j;
+
+        int ch = chmake(sz);
+        assert(ch >= 0);
+        int h = go(copier(ch, sz));
+        assert(h >= 0);
+        int64_t start = now();
+        for(j = 0; j != count; ++j) {
+            int rc = chsend(ch, buf, sz, -1);
+            assert(rc == 0);
+        }
+        int64_t copy = now() - start;
+        hclose(h);
+        hclose(ch);
+
+        ch = chmake_ptr();
+        assert(ch >= 0);
+        h = go(borrower(ch));
+        assert(h >= 0);
+        start = now();
+        for(j = 0; j != count; ++j) {
+            int rc = chsend_ptr(ch, buf, sz, -1);
+            assert(rc == 0);
+        }
+        int64_t ptr = now() - start;
+        hclose(h);
+        hclose(ch);
+
+        printf("%10zu %16ld %16ld\n", sz, (long)(copy * 1000000 / count),
+            (long)(ptr * 1000000 / count));
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../libdill.h"
+
+struct args {
+    void *in;
+    void *out;
+};
+
+/* Bounces messages back to the sender. */
+static void *echo(void *arg) {
+    struct args *args = arg;
+    int in = chimport(args->in);
+    int out = chimport(args->out);
+    int val;
+    while(chrecv(in, &val, sizeof(val), -1) == 0)
+        chsend(out, &val, sizeof(val), -1);
+    hclose(out);
+    hclose(in);
+    return NULL;
+}
+
+/* Receives messages until the channel is done. */
+static void *sink(void *arg) {
+    int in = chimport(arg);
+    int vals[64];
+    while(chrecvv(in, vals, 64, -1) > 0);
+    hclose(in);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: chmt <millions-of-messages>\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000000;
+
+    /* Latency: roundtrips between two threads. */
+    int out = chmake_mt(sizeof(int), 1);
+    int in = chmake_mt(sizeof(int), 1);
+    struct args args = {chexport(out), chexport(in)};
+    pthread_t t;
+    int rc = pthread_create(&t, NULL, echo, &args);
+    assert(rc == 0);
+    long roundtrips = count / 10;
+    int val = 0;
+    long i;
+    int64_t start = now();
+    for(i = 0; i != roundtrips; ++i) {
+        chsend(out, &val, sizeof(val), -1);
+        chrecv(in, &val, sizeof(val), -1);
+    }
+    int64_t stop = now();
+    chdone(out);
+    rc = pthread_join(t, NULL);
+    assert(rc == 0);
+    hclose(in);
+    hclose(out);
+    long duration = (long)(stop - start);
+    printf("cross-thread roundtrip latency: %ld ns\n",
+        (long)(duration * 1000000 / roundtrips));
+
+    /* Throughput: stream of messages to a different thread. */
+    out = chmake_mt(sizeof(int), 1024);
+    rc = pthread_create(&t, NULL, sink, chexport(out));
+    assert(rc == 0);
+    start = now();
+    for(i = 0; i != count; ++i)
+        chsend(out, &val, sizeof(val), -1);
+    chdone(out);
+    rc = pthread_join(t, NULL);
+    assert(rc == 0);
+    stop = now();
+    hclose(out);
+    duration = (long)(stop - start);
+    long ns = duration * 1000000 / count;
+    printf("done %ldM cross-thread messages in %f seconds\n",
+        (long)(count / 1000000), ((float)duration) / 1000);
+    printf("duration of passing a single message: %ld ns\n", ns);
+    printf("message passes per second: %fM\n",
+        (float)(1000000000 / (ns ? ns : 1)) / 1000000);
+
+    return 0;
+}
@@ -26,29 +26,53 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 
 #include "../libdill.h"
 
-static coroutine void worker(long count) {
+static coroutine void worker(long count, int ch) {
     long i;
     for(i = 0; i != count; ++i)
         yield();
+    if(ch >= 0) {
+        int rc = chsend(ch, &i, sizeof(i), -1);
+        assert(rc == 0);
+    }
 }
 
 int main(int argc, char *argv[]) {
-    if(argc != 2) {
-        printf("usage: ctxswitch <millions-of-context-switches>\n");
+    if(argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "shared"))) {
+        printf("usage: ctxswitch <millions-of-context-switches> [shared]\n");
         return 1;
     }
     long count = atol(argv[1]) * 1000000 / 2;
 
     int64_t start = now();
-    go(worker(count));
-
     long i;
-    for(i = 0; i != count; ++i)
-        yield();
+    if(argc == 3) {
+        /* Two coroutines on the shared stack switching between each other.
+           Each switch swaps the content of the shared stack. */
+        int ch = chmake(sizeof(long));
+        assert(ch >= 0);
+        int h1 = go_shared(worker(count, ch));
+        assert(h1 >= 0);
+        int h2 = go_shared(worker(count, ch));
+        assert(h2 >= 0);
+        for(i = 0; i != 2; ++i) {
+            long val;
+            int rc = chrecv(ch, &val, sizeof(val), -1);
+            assert(rc == 0);
+        }
+        hclose(h2);
+        hclose(h1);
+        hclose(ch);
+    }
+    else {
+        go(worker(count, -1));
+        for(i = 0; i != count; ++i)
+            yield();
+    }
 
     int64_t stop = now();
     long duration = (long)(stop - start);
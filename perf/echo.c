@@ -0,0 +1,209 @@
+/*
+
+  Copyright (c) 2015 Alex Cornejo
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <sys/ptrace.h>
+#endif
+
+#include "../libdill.h"
+
+/* Echo over a socket pair. Reports the time and the number of syscalls
+   per roundtrip. Syscalls are counted by running the loop in a child
+   process traced by the parent. */
+
+#define FDIN 0
+#define FDREAD 1
+/* The echo server briefly blocks on a timer before replying, which makes
+   the pollset run while the server isn't waiting for its fd. */
+#define FDIN_SLEEP 2
+
+static const char *names[] = {
+    "fdin + read         ",
+    "fdread/fdwrite      ",
+    "fdin + read + msleep"
+};
+
+static long count;
+
+static ssize_t readiness_read(int fd, void *buf, size_t len) {
+    while(1) {
+        ssize_t sz = read(fd, buf, len);
+        if(sz >= 0) return sz;
+        assert(errno == EAGAIN);
+        int rc = fdin(fd, -1);
+        if(rc < 0) return -1;
+    }
+}
+
+static coroutine void echo(int fd, int mode) {
+    char buf[16];
+    while(1) {
+        ssize_t sz = mode == FDREAD ? fdread(fd, buf, sizeof(buf), -1) :
+            readiness_read(fd, buf, sizeof(buf));
+        if(sz < 0 && errno == ECANCELED) return;
+        assert(sz > 0);
+        if(mode == FDIN_SLEEP) {
+            int rc = msleep(now());
+            if(rc < 0 && errno == ECANCELED) return;
+            assert(rc == 0);
+        }
+        sz = mode == FDREAD ? fdwrite(fd, buf, sz, -1) : write(fd, buf, sz);
+        assert(sz > 0);
+    }
+}
+
+/* Returns duration of the loop in milliseconds. */
+static int64_t run(int mode, int traced) {
+    int fds[2];
+    int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(rc == 0);
+    int i;
+    for(i = 0; i != 2; ++i) {
+        rc = fcntl(fds[i], F_SETFL, O_NONBLOCK);
+        assert(rc == 0);
+    }
+    int h = go(echo(fds[1], mode));
+    assert(h >= 0);
+    /* Let both sides register their fds before the measurement starts. */
+    char c = 'a';
+    ssize_t sz = write(fds[0], &c, 1);
+    assert(sz == 1);
+    sz = readiness_read(fds[0], &c, 1);
+    assert(sz == 1);
+    /* The marker syscalls delimit the measured part for the tracer. */
+    if(traced) syscall(SYS_getppid);
+    int64_t start = now();
+    long j;
+    for(j = 0; j != count; ++j) {
+        sz = mode == FDREAD ? fdwrite(fds[0], &c, 1, -1) :
+            write(fds[0], &c, 1);
+        assert(sz == 1);
+        sz = mode == FDREAD ? fdread(fds[0], &c, 1, -1) :
+            readiness_read(fds[0], &c, 1);
+        assert(sz == 1);
+    }
+    int64_t stop = now();
+    if(traced) syscall(SYS_getppid);
+    rc = hclose(h);
+    assert(rc == 0);
+    fdclean(fds[0]);
+    fdclean(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    return stop - start;
+}
+
+#if defined __linux__ && defined PTRACE_GET_SYSCALL_INFO
+
+/* Runs the loop in a traced child process and prints the number of
+   syscalls per roundtrip. */
+static void trace(int mode) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0) {
+        long rc = ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        assert(rc == 0);
+        raise(SIGSTOP);
+        run(mode, 1);
+        _exit(0);
+    }
+    int status;
+    pid_t p = waitpid(pid, &status, 0);
+    assert(p == pid && WIFSTOPPED(status));
+    long rc = ptrace(PTRACE_SETOPTIONS, pid, NULL,
+        (void*)PTRACE_O_TRACESYSGOOD);
+    assert(rc == 0);
+    int markers = 0;
+    long total = 0, ctl = 0, wait = 0;
+    int sig = 0;
+    while(1) {
+        rc = ptrace(PTRACE_SYSCALL, pid, NULL, (void*)(long)sig);
+        assert(rc == 0);
+        p = waitpid(pid, &status, 0);
+        assert(p == pid);
+        if(WIFEXITED(status) || WIFSIGNALED(status)) break;
+        /* Pass signals other than syscall stops to the child. */
+        sig = WSTOPSIG(status);
+        if(sig != (SIGTRAP | 0x80)) continue;
+        sig = 0;
+        struct __ptrace_syscall_info info;
+        rc = ptrace(PTRACE_GET_SYSCALL_INFO, pid, (void*)sizeof(info), &info);
+        assert(rc > 0);
+        if(info.op != PTRACE_SYSCALL_INFO_ENTRY) continue;
+        if(info.entry.nr == SYS_getppid) {++markers; continue;}
+        if(markers != 1) continue;
+        ++total;
+        if(info.entry.nr == SYS_epoll_ctl) ++ctl;
+        if(info.entry.nr == SYS_epoll_pwait
+#if defined SYS_epoll_wait
+              || info.entry.nr == SYS_epoll_wait
+#endif
+#if defined SYS_epoll_pwait2
+              || info.entry.nr == SYS_epoll_pwait2
+#endif
+              ) ++wait;
+    }
+    printf("%s: %.2f syscalls per roundtrip (epoll_ctl: %.2f, "
+        "epoll_wait: %.2f)\n", names[mode], (double)total / count,
+        (double)ctl / count, (double)wait / count);
+}
+
+#else
+
+static void trace(int mode) {
+    printf("%s: syscall counting not supported on this platform\n",
+        names[mode]);
+}
+
+#endif
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: echo <thousands-of-roundtrips>\n");
+        return 1;
+    }
+    count = atol(argv[1]) * 1000;
+    /* Fork the traced children before this process starts using libdill
+       so that they don't share the pollset with it. */
+    int mode;
+    for(mode = 0; mode != 3; ++mode)
+        trace(mode);
+    for(mode = 0; mode != 3; ++mode) {
+        int64_t duration = run(mode, 0);
+        printf("%s: roundtrip takes %ld ns\n", names[mode],
+            (long)((double)duration * 1000000 / count));
+    }
+    return 0;
+}
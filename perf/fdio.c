@@ -0,0 +1,105 @@
+/*
+
+  Copyright (c) 2015 Alex Cornejo
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../libdill.h"
+
+/* Ping-pong over a socket pair. Compares waiting for readiness followed by
+   a syscall with completion-based fdread()/fdwrite(). */
+
+static long count;
+
+static ssize_t readiness_read(int fd, void *buf, size_t len) {
+    while(1) {
+        ssize_t sz = read(fd, buf, len);
+        if(sz >= 0) return sz;
+        assert(errno == EAGAIN);
+        int rc = fdin(fd, -1);
+        assert(rc == 0);
+    }
+}
+
+static coroutine void echo(int fd, int completion) {
+    char c;
+    long i;
+    for(i = 0; i != count; ++i) {
+        ssize_t sz = completion ? fdread(fd, &c, 1, -1) :
+            readiness_read(fd, &c, 1);
+        assert(sz == 1);
+        sz = completion ? fdwrite(fd, &c, 1, -1) : write(fd, &c, 1);
+        assert(sz == 1);
+    }
+}
+
+static void run(int completion) {
+    int fds[2];
+    int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(rc == 0);
+    int i;
+    for(i = 0; i != 2; ++i) {
+        rc = fcntl(fds[i], F_SETFL, O_NONBLOCK);
+        assert(rc == 0);
+    }
+    int h = go(echo(fds[1], completion));
+    assert(h >= 0);
+    char c = 'a';
+    int64_t start = now();
+    long j;
+    for(j = 0; j != count; ++j) {
+        ssize_t sz = completion ? fdwrite(fds[0], &c, 1, -1) :
+            write(fds[0], &c, 1);
+        assert(sz == 1);
+        sz = completion ? fdread(fds[0], &c, 1, -1) :
+            readiness_read(fds[0], &c, 1);
+        assert(sz == 1);
+    }
+    int64_t stop = now();
+    hclose(h);
+    fdclean(fds[0]);
+    fdclean(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    long duration = (long)(stop - start);
+    printf("%s: roundtrip takes %ld ns\n",
+        completion ? "fdread/fdwrite" : "fdin + read   ",
+        (long)((double)duration * 1000000 / count));
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: fdio <thousands-of-roundtrips>\n");
+        return 1;
+    }
+    count = atol(argv[1]) * 1000;
+    run(0);
+    run(1);
+    return 0;
+}
@@ -23,9 +23,12 @@
 */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 
 #include "../libdill.h"
@@ -33,12 +36,51 @@
 static coroutine void worker(void) {
 }
 
+static coroutine void idle(void) {
+    msleep(-1);
+}
+
+/* Peak resident set size in kilobytes. */
+static long maxrss(void) {
+    struct rusage ru;
+    int rc = getrusage(RUSAGE_SELF, &ru);
+    assert(rc == 0);
+#if defined __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+/* Number of memory mappings in the process, -1 if unknown. */
+static long mappings(void) {
+    FILE *f = fopen("/proc/self/maps", "r");
+    if(!f) return -1;
+    long n = 0;
+    int c;
+    while((c = fgetc(f)) != EOF)
+        if(c == '\n') ++n;
+    fclose(f);
+    return n;
+}
+
 int main(int argc, char *argv[]) {
-    if(argc != 2) {
-        printf("usage: go <millions-of-coroutines>\n");
+    if(argc < 2 || argc > 4) {
+        printf("usage: go <millions-of-coroutines> "
+            "[thousands-of-idle-coroutines] [guard|canary|shared]\n");
         return 1;
     }
     long count = atol(argv[1]) * 1000000;
+    long idles = (argc >= 3 ? atol(argv[2]) : 10) * 1000;
+    int shared = argc == 4 && strcmp(argv[3], "shared") == 0;
+    if(argc == 4 && !shared) {
+        int rc = stackarena(strcmp(argv[3], "canary") == 0 ?
+            STACKARENACANARY : STACKARENAGUARD);
+        if(rc < 0) {
+            perror("stackarena");
+            return 1;
+        }
+    }
 
     int64_t start = now();
 
@@ -58,6 +100,40 @@ int main(int argc, char *argv[]) {
     printf("coroutine creations+terminations per second: %fM\n",
         (float)(1000000000 / ns) / 1000000);
 
+    /* Keep lots of coroutines alive at the same time to measure the
+       creation rate with no stack reuse and the memory footprint. */
+    int *hndls = malloc(idles * sizeof(int));
+    assert(hndls);
+    long rss = maxrss();
+    long maps = mappings();
+    start = now();
+    for(i = 0; i != idles; ++i) {
+        hndls[i] = shared ? go_shared(idle()) : go(idle());
+        if(hndls[i] < 0) {
+            printf("go() failed after %ld coroutines: %s\n", i,
+                strerror(errno));
+            break;
+        }
+    }
+    idles = i;
+    stop = now();
+    rss = maxrss() - rss;
+    if(maps >= 0) maps = mappings() - maps;
+    duration = (long)(stop - start);
+    printf("created %ldK idle coroutines in %f seconds\n",
+        idles / 1000, ((float)duration) / 1000);
+    if(duration > 0)
+        printf("idle coroutine creations per second: %fK\n",
+            (float)idles / duration);
+    if(idles > 0)
+        printf("resident memory per idle coroutine: %ld bytes\n",
+            rss * 1024 / idles);
+    if(maps >= 0)
+        printf("memory mappings added: %ld\n", maps);
+    for(i = 0; i != idles; ++i)
+        hclose(hndls[i]);
+    free(hndls);
+
     return 0;
 }
 
@@ -0,0 +1,63 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "../libdill.h"
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: now <millions-of-calls>\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000000;
+
+    /* Make sure that the results of the calls are actually used. */
+    int64_t sum = 0;
+
+    int64_t start = now();
+    long i;
+    for(i = 0; i != count; ++i)
+        sum += now();
+    int64_t stop = now();
+    long precise = (long)(stop - start);
+
+    start = now();
+    for(i = 0; i != count; ++i)
+        sum += now_coarse();
+    stop = now();
+    long coarse = (long)(stop - start);
+
+    assert(sum > 0);
+    printf("done %ldM calls of each function\n", (long)(count / 1000000));
+    printf("duration of now(): %ld ns\n", (precise * 1000000) / count);
+    printf("duration of now_coarse(): %ld ns\n", (coarse * 1000000) / count);
+
+    return 0;
+}
+
@@ -0,0 +1,145 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libdill.h"
+
+/* Measures how late the timers fire while other coroutines read a file,
+   either directly or via offload(). */
+
+#define CHUNK (1024 * 1024)
+
+static int fd;
+static long filesz;
+static int stop;
+
+struct job {
+    char *buf;
+    off_t off;
+};
+
+static void doread(void *arg) {
+    struct job *r = arg;
+#if defined POSIX_FADV_DONTNEED
+    /* Make sure the data is not served from the page cache. */
+    posix_fadvise(fd, r->off, CHUNK, POSIX_FADV_DONTNEED);
+#endif
+    ssize_t sz = pread(fd, r->buf, CHUNK, r->off);
+    assert(sz == CHUNK);
+}
+
+coroutine void reader(int useoffload, long *bytes) {
+    struct job r;
+    r.buf = malloc(CHUNK);
+    assert(r.buf);
+    r.off = 0;
+    while(!stop) {
+        if(useoffload) {
+            int rc = offload(doread, &r, -1);
+            if(rc < 0) break;
+        }
+        else {
+            doread(&r);
+            int rc = yield();
+            if(rc < 0) break;
+        }
+        *bytes += CHUNK;
+        r.off = (r.off + CHUNK) % filesz;
+    }
+    free(r.buf);
+}
+
+static void run(int useoffload, int nreaders, int64_t duration) {
+    long bytes = 0;
+    int hndls[nreaders];
+    int i;
+    stop = 0;
+    for(i = 0; i != nreaders; ++i) {
+        hndls[i] = go(reader(useoffload, &bytes));
+        assert(hndls[i] >= 0);
+    }
+    /* Tick every millisecond and record how late the ticks are. */
+    int64_t start = now_ns();
+    int64_t deadline = start;
+    int64_t maxlate = 0;
+    int64_t totallate = 0;
+    long ticks = 0;
+    while(deadline - start < duration * 1000000) {
+        deadline += 1000000;
+        int rc = nsleep(deadline);
+        assert(rc == 0);
+        int64_t late = now_ns() - deadline;
+        if(late > maxlate) maxlate = late;
+        totallate += late;
+        ++ticks;
+        if(late > 1000000) deadline = now_ns();
+    }
+    stop = 1;
+    for(i = 0; i != nreaders; ++i)
+        hclose(hndls[i]);
+    printf("%s: read %ld MB/s, tick lateness avg %ld us, max %ld us\n",
+        useoffload ? "offload" : "direct ",
+        (long)(bytes / duration * 1000 / (1024 * 1024)),
+        (long)(totallate / ticks / 1000), (long)(maxlate / 1000));
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argc > 4) {
+        printf("usage: offload <file-size-in-MB> [readers] [milliseconds]\n");
+        return 1;
+    }
+    filesz = atol(argv[1]) * CHUNK;
+    int nreaders = argc > 2 ? atoi(argv[2]) : 4;
+    int64_t duration = argc > 3 ? atol(argv[3]) : 1000;
+    assert(filesz > 0 && nreaders > 0 && duration > 0);
+
+    char path[] = "/tmp/dill-offload-XXXXXX";
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    char *buf = malloc(CHUNK);
+    assert(buf);
+    memset(buf, 'x', CHUNK);
+    long i;
+    for(i = 0; i != filesz / CHUNK; ++i) {
+        ssize_t sz = write(fd, buf, CHUNK);
+        assert(sz == CHUNK);
+    }
+    fsync(fd);
+    free(buf);
+
+    run(0, nreaders, duration);
+    run(1, nreaders, duration);
+
+    close(fd);
+    return 0;
+}
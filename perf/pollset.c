@@ -0,0 +1,148 @@
+/*
+
+  Copyright (c) 2015 Alex Cornejo
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#if defined __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "../libdill.h"
+
+/* A lot of idle file descriptors and a smaller set of busy ones. Measures
+   the cost of a single readiness event for whatever polling mechanism
+   the library was built with. */
+
+#define STACKSZ 16384
+
+static long hot;
+static long events = 0;
+static int done;
+
+/* Waits for an fd that never becomes readable. */
+static coroutine void idle(int fd) {
+    fdin(fd, -1);
+}
+
+/* Reads a byte each time the fd becomes readable. */
+static coroutine void reader(int fd) {
+    while(1) {
+        int rc = fdin(fd, -1);
+        if(rc < 0) return;
+        char c;
+        ssize_t sz = read(fd, &c, 1);
+        assert(sz == 1);
+        /* Let the driver know that the round is over. */
+        if(++events % hot == 0) {
+            rc = chsend(done, &c, 1, -1);
+            if(rc < 0) return;
+        }
+    }
+}
+
+static int idlefd(void) {
+#if defined __linux__
+    return eventfd(0, 0);
+#else
+    int fds[2];
+    int rc = pipe(fds);
+    assert(rc == 0);
+    return fds[0];
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    if(argc > 4) {
+        printf("usage: pollset [idle-fds] [hot-fds] [rounds]\n");
+        return 1;
+    }
+    long nidle = argc > 1 ? atol(argv[1]) : 10000;
+    hot = argc > 2 ? atol(argv[2]) : 1000;
+    long rounds = argc > 3 ? atol(argv[3]) : 1000;
+    assert(hot > 0);
+
+    struct rlimit rl;
+    int rc = getrlimit(RLIMIT_NOFILE, &rl);
+    assert(rc == 0);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    char *stacks = malloc((nidle + hot) * STACKSZ);
+    assert(stacks);
+    int *hndls = malloc((nidle + hot) * sizeof(int));
+    assert(hndls);
+    int *writers = malloc(hot * sizeof(int));
+    assert(writers);
+    long i;
+    for(i = 0; i != nidle; ++i) {
+        int fd = idlefd();
+        assert(fd >= 0);
+        hndls[i] = go_mem(idle(fd), stacks + i * STACKSZ, STACKSZ);
+        assert(hndls[i] >= 0);
+    }
+    for(i = 0; i != hot; ++i) {
+        int fds[2];
+        rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        assert(rc == 0);
+        writers[i] = fds[1];
+        hndls[nidle + i] = go_mem(reader(fds[0]),
+            stacks + (nidle + i) * STACKSZ, STACKSZ);
+        assert(hndls[nidle + i] >= 0);
+    }
+    done = chmake(1);
+    assert(done >= 0);
+
+    int64_t start = now();
+    long round;
+    for(round = 0; round != rounds; ++round) {
+        for(i = 0; i != hot; ++i) {
+            ssize_t sz = write(writers[i], "a", 1);
+            assert(sz == 1);
+        }
+        char c;
+        rc = chrecv(done, &c, 1, -1);
+        assert(rc == 0);
+    }
+    int64_t stop = now();
+
+    long duration = (long)(stop - start);
+    long count = rounds * hot;
+    long ns = (long)((double)duration * 1000000 / count);
+    printf("%ld idle fds, %ld hot fds\n", nidle, hot);
+    printf("processed %ld events in %f seconds\n", count,
+        ((float)duration) / 1000);
+    printf("duration of one event: %ld ns\n", ns);
+    printf("events per second: %fM\n",
+        (float)(1000000000 / (ns ? ns : 1)) / 1000000);
+
+    for(i = 0; i != nidle + hot; ++i)
+        hclose(hndls[i]);
+    hclose(done);
+    return 0;
+}
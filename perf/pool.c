@@ -0,0 +1,102 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../libdill.h"
+
+/* Fork-join workload: a binary tree of tasks with a chunk of CPU-bound work
+   in each leaf. */
+
+static int pool;
+static long work;
+static long remaining;
+static void *done;
+static volatile uint64_t sink;
+
+static void leaf(void *arg) {
+    uint64_t x = (uintptr_t)arg;
+    long i;
+    for(i = 0; i != work; ++i)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    sink = x;
+    if(__atomic_sub_fetch(&remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        int ch = chimport(done);
+        int val = 0;
+        chsend(ch, &val, sizeof(val), -1);
+        hclose(ch);
+    }
+}
+
+static void split(void *arg) {
+    uintptr_t depth = (uintptr_t)arg;
+    int p = poolself();
+    if(depth == 0) {
+        leaf(arg);
+        return;
+    }
+    poolgo(p, split, (void*)(depth - 1));
+    poolgo(p, split, (void*)(depth - 1));
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 3 || argc > 4) {
+        printf("usage: pool <depth> <work-per-leaf> [max-threads]\n");
+        return 1;
+    }
+    long depth = atol(argv[1]);
+    work = atol(argv[2]);
+    int maxthreads = argc == 4 ? atoi(argv[3]) : 4;
+    long leaves = 1L << depth;
+
+    int nthreads;
+    int64_t base = 0;
+    for(nthreads = 1; nthreads <= maxthreads; ++nthreads) {
+        pool = poolmake(nthreads);
+        assert(pool >= 0);
+        int ch = chmake_mt(sizeof(int), 1);
+        assert(ch >= 0);
+        done = chexport(ch);
+        remaining = leaves;
+        int64_t start = now();
+        int rc = poolgo(pool, split, (void*)(uintptr_t)depth);
+        assert(rc == 0);
+        int val;
+        rc = chrecv(ch, &val, sizeof(val), -1);
+        assert(rc == 0);
+        int64_t stop = now();
+        hclose(ch);
+        hclose(pool);
+        long duration = (long)(stop - start);
+        if(nthreads == 1) base = duration;
+        printf("%d thread(s): %ld tasks in %f seconds, speedup %.2fx\n",
+            nthreads, leaves * 2 - 1, ((float)duration) / 1000,
+            duration ? (float)base / duration : 0.0);
+    }
+
+    return 0;
+}
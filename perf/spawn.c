@@ -0,0 +1,110 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../libdill.h"
+
+/* Each thread repeatedly launches a burst of coroutines and then closes
+   them. Bursts are bigger than the per-thread stack cache so the stacks
+   travel between the threads via the process-wide pool. */
+
+static long rounds;
+static long burst;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stackstats total;
+
+static coroutine void worker(void) {
+}
+
+static void *spawner(void *arg) {
+    int *hndls = malloc(burst * sizeof(int));
+    assert(hndls);
+    long i, j;
+    for(i = 0; i != rounds; ++i) {
+        for(j = 0; j != burst; ++j) {
+            hndls[j] = go(worker());
+            assert(hndls[j] >= 0);
+        }
+        for(j = 0; j != burst; ++j)
+            hclose(hndls[j]);
+    }
+    free(hndls);
+    struct stackstats st;
+    int rc = stackstats(&st);
+    assert(rc == 0);
+    pthread_mutex_lock(&lock);
+    total.allocs += st.allocs;
+    total.hits += st.hits;
+    total.refills += st.refills;
+    total.refillmisses += st.refillmisses;
+    total.spills += st.spills;
+    total.spillmisses += st.spillmisses;
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 4) {
+        printf("usage: spawn <threads> <rounds> <coroutines-per-round>\n");
+        return 1;
+    }
+    long nthreads = atol(argv[1]);
+    rounds = atol(argv[2]);
+    burst = atol(argv[3]);
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    assert(threads);
+
+    int64_t start = now();
+    long i;
+    for(i = 0; i != nthreads; ++i) {
+        int rc = pthread_create(&threads[i], NULL, spawner, NULL);
+        assert(rc == 0);
+    }
+    for(i = 0; i != nthreads; ++i) {
+        int rc = pthread_join(threads[i], NULL);
+        assert(rc == 0);
+    }
+    int64_t stop = now();
+
+    long count = nthreads * rounds * burst;
+    long duration = (long)(stop - start);
+    long ns = (long)((double)duration * 1000000 / count);
+    printf("executed %ld coroutines in %ld threads in %f seconds\n",
+        count, nthreads, ((float)duration) / 1000);
+    printf("duration of one coroutine creation+termination: %ld ns\n", ns);
+    printf("stack cache hit rate: %.2f%%\n",
+        100.0 * total.hits / total.allocs);
+    printf("batches taken from the pool: %llu, pool empty: %llu\n",
+        (unsigned long long)total.refills,
+        (unsigned long long)total.refillmisses);
+    printf("batches given to the pool: %llu, pool full: %llu\n",
+        (unsigned long long)total.spills,
+        (unsigned long long)total.spillmisses);
+    free(threads);
+    return 0;
+}
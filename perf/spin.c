@@ -0,0 +1,120 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../libdill.h"
+
+/* Measures the latency of a roundtrip between two threads with and without
+   busy-polling. Each thread should have a CPU core of its own. */
+
+static int spin;
+
+static void *echo(void *arg) {
+    int fd = *(int*)arg;
+    int rc = pollspin(spin, 0);
+    assert(rc == 0);
+    while(1) {
+        char c;
+        ssize_t sz = fdread(fd, &c, 1, -1);
+        if(sz == 0) break;
+        assert(sz == 1);
+        sz = fdwrite(fd, &c, 1, -1);
+        assert(sz == 1);
+    }
+    fdclean(fd);
+    close(fd);
+    return NULL;
+}
+
+static int cmp(const void *a, const void *b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void run(long count) {
+    int fds[2];
+    int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(rc == 0);
+    rc = fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    assert(rc == 0);
+    rc = fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    assert(rc == 0);
+    pthread_t thread;
+    rc = pthread_create(&thread, NULL, echo, &fds[1]);
+    assert(rc == 0);
+    rc = pollspin(spin, 0);
+    assert(rc == 0);
+    int64_t *lat = malloc(sizeof(int64_t) * count);
+    assert(lat);
+    struct pollstats st1, st2;
+    rc = pollstats(&st1);
+    assert(rc == 0);
+    long i;
+    for(i = 0; i != count; ++i) {
+        int64_t start = now_ns();
+        char c = 'A';
+        ssize_t sz = fdwrite(fds[0], &c, 1, -1);
+        assert(sz == 1);
+        sz = fdread(fds[0], &c, 1, -1);
+        assert(sz == 1);
+        lat[i] = now_ns() - start;
+    }
+    rc = pollstats(&st2);
+    assert(rc == 0);
+    fdclean(fds[0]);
+    close(fds[0]);
+    rc = pthread_join(thread, NULL);
+    assert(rc == 0);
+    qsort(lat, count, sizeof(int64_t), cmp);
+    printf("spin %4d us: roundtrip p50 %ld ns, p99 %ld ns, max %ld ns; "
+        "spun %ld us, %.0f%% of spins hit\n", spin,
+        (long)lat[count / 2], (long)lat[count * 99 / 100],
+        (long)lat[count - 1], (long)((st2.spintime - st1.spintime) / 1000),
+        st2.spins == st1.spins ? 0.0 : 100.0 * (st2.spinhits - st1.spinhits) /
+        (st2.spins - st1.spins));
+    free(lat);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argc > 3) {
+        printf("usage: spin <thousands-of-roundtrips> [spin-in-us]\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000;
+    assert(count > 0);
+    spin = 0;
+    run(count);
+    spin = argc > 2 ? atoi(argv[2]) : 50;
+    run(count);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "../libdill.h"
+
+/* The background coroutines do nothing but sleep, which means their stacks
+   can be tiny. All of them are carved from a single allocation. */
+#define STACK_SIZE 8192
+
+static coroutine void sleeper(int64_t deadline) {
+    msleep(deadline);
+}
+
+static coroutine void worker(int ch) {
+    int val = 0;
+    while(1) {
+        int rc = chsend(ch, &val, sizeof(val), -1);
+        if(rc != 0) return;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: timer <thousands-of-timers>\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000;
+    long roundtrips = 1000000;
+
+    char *stacks = malloc(count * STACK_SIZE);
+    assert(stacks);
+    int *hndls = malloc(count * sizeof(int));
+    assert(hndls);
+
+    /* Arm 'count' timers. They all expire an hour from now. Equal deadlines
+       are the worst case for an ordered list. */
+    int64_t deadline = now() + 3600000;
+    int64_t start = now();
+    long i;
+    for(i = 0; i != count; ++i) {
+        hndls[i] = go_mem(sleeper(deadline), stacks + i * STACK_SIZE,
+            STACK_SIZE);
+        assert(hndls[i] >= 0);
+    }
+    int64_t stop = now();
+    long arm = (long)(stop - start);
+
+    /* Each receive arms a timer with the deadline later than all the existing
+       ones and cancels it once the message arrives. */
+    int ch = chmake(sizeof(int));
+    assert(ch >= 0);
+    int wh = go(worker(ch));
+    assert(wh >= 0);
+    start = now();
+    for(i = 0; i != roundtrips; ++i) {
+        int val;
+        int rc = chrecv(ch, &val, sizeof(val), deadline + 3600000);
+        assert(rc == 0);
+    }
+    stop = now();
+    long churn = (long)(stop - start);
+
+    /* Cancel all the timers. */
+    start = now();
+    for(i = 0; i != count; ++i)
+        hclose(hndls[i]);
+    stop = now();
+    long cancel = (long)(stop - start);
+
+    hclose(wh);
+    hclose(ch);
+    free(hndls);
+    free(stacks);
+
+    printf("armed %ldk timers in %f seconds\n", count / 1000,
+        ((float)arm) / 1000);
+    if(count)
+        printf("duration of arming a timer: %ld ns\n",
+            (arm * 1000000) / count);
+    printf("duration of arm+cancel with %ldk timers active: %ld ns\n",
+        count / 1000, (churn * 1000000) / roundtrips);
+    if(count)
+        printf("duration of canceling a timer: %ld ns\n",
+            (cancel * 1000000) / count);
+
+    return 0;
+}
+
@@ -0,0 +1,150 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "../libdill.h"
+#include "../heap.c"
+#include "../list.h"
+#include "../wheel.c"
+
+/* Compares the data structures that can be used to store timers. Each
+   operation arms a new timer and cancels the oldest one, so that 'count'
+   timers are outstanding at any time. None of the timers ever expires. */
+
+/* Every 1000 operations one millisecond elapses. Timeout is 30 seconds. */
+#define TIMEOUT 30000
+
+struct tm {
+    int64_t deadline;
+    struct dill_list litem;
+    struct dill_heap_item hitem;
+    struct dill_wheel_item witem;
+};
+
+/* Sorted list, the way timers were stored originally. */
+static void list_add(struct dill_list *lst, struct tm *tm) {
+    struct dill_list *it = dill_list_next(lst);
+    while(it != lst) {
+        struct tm *itm = dill_cont(it, struct tm, litem);
+        if(itm->deadline > tm->deadline) break;
+        it = dill_list_next(it);
+    }
+    dill_list_insert(&tm->litem, it);
+}
+
+static long bench_list(struct tm *tms, long count, long ops) {
+    struct dill_list lst;
+    dill_list_init(&lst);
+    long i;
+    /* All the initial deadlines are equal so they can be simply appended. */
+    for(i = 0; i != count; ++i) {
+        tms[i].deadline = TIMEOUT;
+        dill_list_insert(&tms[i].litem, &lst);
+    }
+    int64_t start = now();
+    for(i = 0; i != ops; ++i) {
+        struct tm *tm = &tms[i % count];
+        dill_list_erase(&tm->litem);
+        tm->deadline = i / 1000 + TIMEOUT;
+        list_add(&lst, tm);
+    }
+    int64_t stop = now();
+    return (long)(stop - start);
+}
+
+static long bench_heap(struct tm *tms, long count, long ops) {
+    struct dill_heap heap;
+    dill_heap_init(&heap);
+    long i;
+    for(i = 0; i != count; ++i) {
+        tms[i].hitem.val = TIMEOUT;
+        dill_heap_push(&heap, &tms[i].hitem);
+    }
+    int64_t start = now();
+    for(i = 0; i != ops; ++i) {
+        struct tm *tm = &tms[i % count];
+        dill_heap_erase(&heap, &tm->hitem);
+        tm->hitem.val = i / 1000 + TIMEOUT;
+        dill_heap_push(&heap, &tm->hitem);
+        if(i % 1000 == 0) assert(dill_heap_top(&heap)->val > i / 1000);
+    }
+    int64_t stop = now();
+    dill_heap_term(&heap);
+    return (long)(stop - start);
+}
+
+static long bench_wheel(struct tm *tms, long count, long ops) {
+    struct dill_wheel wheel;
+    dill_wheel_init(&wheel, 0);
+    long i;
+    for(i = 0; i != count; ++i) {
+        tms[i].witem.val = TIMEOUT;
+        dill_wheel_add(&wheel, &tms[i].witem);
+    }
+    int64_t start = now();
+    for(i = 0; i != ops; ++i) {
+        struct tm *tm = &tms[i % count];
+        dill_wheel_erase(&wheel, &tm->witem);
+        tm->witem.val = i / 1000 + TIMEOUT;
+        dill_wheel_add(&wheel, &tm->witem);
+        if(i % 1000 == 0) assert(!dill_wheel_top(&wheel, i / 1000));
+    }
+    int64_t stop = now();
+    dill_wheel_term(&wheel);
+    return (long)(stop - start);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: wheel <thousands-of-timers>\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000;
+    if(count <= 0) count = 1;
+    long ops = 10000000;
+    /* Don't let the sorted list run forever. */
+    long lops = 100000000 / count;
+    if(lops > ops) lops = ops;
+
+    struct tm *tms = malloc(count * sizeof(struct tm));
+    assert(tms);
+
+    long list = bench_list(tms, count, lops);
+    long heap = bench_heap(tms, count, ops);
+    long wheel = bench_wheel(tms, count, ops);
+    free(tms);
+
+    printf("arm+cancel with %ldk timers active:\n", count / 1000);
+    printf("  list:  %ld ns\n", (list * 1000000) / lops);
+    printf("  heap:  %ld ns\n", (heap * 1000000) / ops);
+    printf("  wheel: %ld ns\n", (wheel * 1000000) / ops);
+
+    return 0;
+}
+
@@ -22,6 +22,102 @@
 
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#if defined __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "cr.h"
+#include "ctx.h"
+#include "list.h"
+#include "pollset.h"
+#include "utils.h"
+
+/* The following helpers are used by the poll-mechanism-specific code to wake
+   the pollset up from other threads. On Linux eventfd is used, elsewhere it's
+   a pipe. */
+
+static void dill_wakefd_init(struct dill_ctx_pollset *ctx) {
+    dill_list_init(&ctx->remote);
+    ctx->wakefd[0] = -1;
+    ctx->wakefd[1] = -1;
+    ctx->wakeup = 0;
+}
+
+static int dill_wakefd_open(struct dill_ctx_pollset *ctx) {
+#if defined __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(dill_slow(fd < 0)) return -1;
+    ctx->wakefd[0] = fd;
+    ctx->wakefd[1] = fd;
+#else
+    int rc = pipe(ctx->wakefd);
+    if(dill_slow(rc < 0)) return -1;
+    int i;
+    for(i = 0; i != 2; ++i) {
+        rc = fcntl(ctx->wakefd[i], F_SETFL, O_NONBLOCK);
+        dill_assert(rc == 0);
+        rc = fcntl(ctx->wakefd[i], F_SETFD, FD_CLOEXEC);
+        dill_assert(rc == 0);
+    }
+#endif
+    return 0;
+}
+
+static void dill_wakefd_term(struct dill_ctx_pollset *ctx) {
+    if(ctx->wakefd[0] < 0) return;
+    int rc = close(ctx->wakefd[0]);
+    dill_assert(rc == 0);
+    if(ctx->wakefd[1] != ctx->wakefd[0]) {
+        rc = close(ctx->wakefd[1]);
+        dill_assert(rc == 0);
+    }
+}
+
+/* Called when the wake fd becomes readable. Resumes all the coroutines that
+   were signaled. Returns the number of clauses triggered. */
+static int dill_wakefd_fire(struct dill_ctx_pollset *ctx) {
+    /* Drain the wake fd first, then clear the flag so that any subsequent
+       signal writes to the wake fd anew. In the reverse order, a write
+       done in between would be drained while the flag stays set, and no
+       further signals would ever write to the fd. Signals that find the
+       flag still set are picked up by the scan below. */
+    uint64_t buf[16];
+    while(read(ctx->wakefd[0], buf, sizeof(buf)) > 0);
+    __atomic_store_n(&ctx->wakeup, 0, __ATOMIC_SEQ_CST);
+    int fired = 0;
+    struct dill_list *it = dill_list_next(&ctx->remote);
+    while(it != &ctx->remote) {
+        struct dill_rcl *rcl = dill_cont(it, struct dill_rcl, cl.epitem);
+        if(__atomic_load_n(&rcl->fired, __ATOMIC_ACQUIRE)) {
+            /* Triggering cancels all the clauses of the coroutine which may
+               remove multiple items from the list. Start anew. */
+            dill_trigger(&rcl->cl, 0);
+            ++fired;
+            it = dill_list_next(&ctx->remote);
+            continue;
+        }
+        it = dill_list_next(it);
+    }
+    return fired;
+}
+
+/* Called when an fd is first used. If requested by pollspin(), it asks
+   the kernel to busy-poll the socket's receive queue instead of waiting
+   for an interrupt. Failures are ignored. The fd may not be a socket or
+   the process may not be allowed to busy-poll for that long. */
+static void dill_busypoll(int fd) {
+#if defined SO_BUSY_POLL
+    int usecs = dill_getctx->cr.busypoll;
+    if(dill_fast(!usecs)) return;
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+#endif
+}
+
 /* Include the poll-mechanism-specific stuff. */
 
 /* User overloads. */
@@ -31,6 +127,8 @@
 #include "kqueue.c.inc"
 #elif defined DILL_POLL
 #include "poll.c.inc"
+#elif defined DILL_IO_URING && defined __linux__
+#include "io_uring.c.inc"
 /* Defaults. */
 #elif defined __linux__ && !defined DILL_NO_EPOLL
 #include "epoll.c.inc"
@@ -39,3 +137,32 @@
 #else
 #include "poll.c.inc"
 #endif
+
+/* Generic part of cross-thread signaling. */
+
+int dill_pollset_rcl(struct dill_rcl *rcl) {
+    struct dill_ctx_pollset *ctx = &dill_getctx->pollset;
+    if(dill_slow(ctx->wakefd[0] < 0)) {
+        int rc = dill_pollset_addwakefd(ctx);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    rcl->ctx = ctx;
+    rcl->fired = 0;
+    return 0;
+}
+
+void dill_pollset_remote(struct dill_rcl *rcl, int id) {
+    dill_waitfor(&rcl->cl, id, &rcl->ctx->remote);
+}
+
+void dill_pollset_signal(struct dill_rcl *rcl) {
+    /* Once 'fired' is set the clause may be gone. Don't touch it. */
+    struct dill_ctx_pollset *ctx = rcl->ctx;
+    __atomic_store_n(&rcl->fired, 1, __ATOMIC_SEQ_CST);
+    /* If the pollset was already woken up, it haven't yet checked the
+       clauses and it will find this one as well. */
+    if(__atomic_exchange_n(&ctx->wakeup, 1, __ATOMIC_SEQ_CST)) return;
+    uint64_t one = 1;
+    ssize_t sz = write(ctx->wakefd[1], &one, sizeof(one));
+    dill_assert(sz == sizeof(one) || (sz < 0 && errno == EAGAIN));
+}
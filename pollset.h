@@ -25,6 +25,13 @@
 #ifndef DILL_POLLSET_INCLUDED
 #define DILL_POLLSET_INCLUDED
 
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cr.h"
+#include "utils.h"
+
 /* User overloads. */
 #if defined DILL_EPOLL
 #include "epoll.h.inc"
@@ -32,6 +39,8 @@
 #include "kqueue.h.inc"
 #elif defined DILL_POLL
 #include "poll.h.inc"
+#elif defined DILL_IO_URING && defined __linux__
+#include "io_uring.h.inc"
 /* Defaults. */
 #elif defined __linux__ && !defined DILL_NO_EPOLL
 #include "epoll.h.inc"
@@ -53,8 +62,89 @@ int dill_pollset_out(struct dill_clause *cl, int id, int fd);
 /* Drops any cached info about the file descriptor. */
 void dill_pollset_clean(int fd);
 
-/* Wait for events. 'timeout' is in milliseconds. Returns 0 if timeout was
-   exceeded. 1 if at least one clause was triggered. */
-int dill_pollset_poll(int timeout);
+/* Sets whether an event on the fd resumes all the coroutines waiting for it
+   (wakeall = 1) or only the one that has been waiting for the longest. */
+int dill_pollset_policy(int fd, int wakeall);
+
+/* Clause that can be triggered from a different thread. */
+struct dill_rcl {
+    struct dill_clause cl;
+    /* Pollset of the thread the waiting coroutine belongs to. */
+    struct dill_ctx_pollset *ctx;
+    /* Set to 1 once the clause is signaled. Accessed atomically. */
+    int fired;
+};
+
+/* Prepares the clause to be signaled. This must be done before the clause is
+   made visible to other threads. */
+int dill_pollset_rcl(struct dill_rcl *rcl);
+
+/* Add waiting for a signal from a different thread to the list of current
+   clauses. If the clause was already signaled it will be triggered during
+   the next poll. */
+void dill_pollset_remote(struct dill_rcl *rcl, int id);
+
+/* Triggers the clause. Can be called from any thread. The caller must make
+   sure that the waiting coroutine doesn't stop waiting for the clause
+   in the meantime, e.g. by holding a lock it has to take to do so. */
+void dill_pollset_signal(struct dill_rcl *rcl);
+
+/* Completion-based I/O operations. */
+#define DILL_IOREAD 0
+#define DILL_IOWRITE 1
+#define DILL_IOREADV 2
+#define DILL_IOWRITEV 3
+#define DILL_IOACCEPT 4
+
+struct dill_iocl {
+    struct dill_clause cl;
+    /* Result of the operation. Same as what the corresponding syscall would
+       return, except that errors are reported as negative errno values. */
+    int res;
+    /* Set once the kernel is done with the operation. */
+    unsigned int done : 1;
+    /* 1 if the coroutine is blocked waiting for the clause. */
+    unsigned int waiting : 1;
+};
+
+/* Starts an I/O operation and adds waiting for its completion to the list
+   of current clauses. 'buf' and 'len' are the buffer, or the iovec array and
+   its size for vectored operations. For accept, they are the address and
+   'arg' points to its length. If the pollset doesn't support completion-based
+   I/O it returns -1 and sets errno to ENOTSUP. */
+int dill_pollset_io(struct dill_iocl *io, int id, int op, int fd, void *buf,
+    size_t len, void *arg);
+
+/* If the operation is still in progress, cancels it. In either case, waits
+   till the kernel is done with the buffers. Must be called if the coroutine
+   stopped waiting for the operation for a different reason. */
+void dill_pollset_iocancel(struct dill_iocl *io);
+
+/* Wait for events. 'timeout' is in nanoseconds, -1 means infinite timeout.
+   Returns 0 if timeout was exceeded. 1 if at least one clause was triggered.
+   Returns -1 if the wait was interrupted by a signal. */
+int dill_pollset_poll(int64_t timeout);
+
+/* Resumes the coroutines waiting for an fd event. If 'all' is 0 only the first
+   one in the list is resumed. The waiting coroutines are appended to the end
+   of the list so they are served in round-robin fashion. Returns 1 if at least
+   one coroutine was resumed, 0 otherwise. */
+static inline int dill_pollset_trigger(struct dill_list *waiters, int all) {
+    if(dill_list_empty(waiters)) return 0;
+    do {
+        struct dill_clause *cl = dill_cont(dill_list_next(waiters),
+            struct dill_clause, epitem);
+        dill_trigger(cl, 0);
+    } while(all && !dill_list_empty(waiters));
+    return 1;
+}
+
+/* Converts timeout in nanoseconds to milliseconds. The value is rounded up
+   so that the polling never ends before the deadline. */
+static inline int dill_mstimeout(int64_t timeout) {
+    if(timeout < 0) return -1;
+    int64_t ms = timeout / 1000000 + (timeout % 1000000 ? 1 : 0);
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
 
 #endif
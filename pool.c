@@ -0,0 +1,605 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libdill.h"
+
+#if !defined DILL_THREADS
+
+int poolmake(int nthreads) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+int poolgo(int pool, void (*fn)(void *arg), void *arg) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+int poolself(void) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+#else
+
+#include <pthread.h>
+
+#include "cr.h"
+#include "list.h"
+#include "pollset.h"
+#include "utils.h"
+
+#define DILL_CACHELINE 64
+
+/* Worker pool. Each worker thread runs its own scheduler. Tasks submitted to
+   the pool are launched as coroutines on one of the workers. Once launched,
+   the coroutine stays in the worker's thread: its stack, handles, timers and
+   file descriptor registrations are all thread-local. What moves between
+   the threads are the tasks that haven't been launched yet. Each worker keeps
+   them in a work-stealing deque (see D. Chase, Y. Lev, "Dynamic Circular
+   Work-Stealing Deque"). Tasks submitted from within the pool go to the local
+   deque. Idle workers steal from the other end of the deques of busy ones. */
+
+struct dill_pool_task {
+    void (*fn)(void *arg);
+    void *arg;
+    /* Handle of the coroutine executing the task. */
+    int h;
+    /* 1 if the worker is canceling the coroutine. */
+    int closing;
+    /* Item in pool's list of submitted tasks or in worker's list of running
+       or finished tasks. */
+    struct dill_list item;
+};
+
+struct dill_pool_array {
+    /* Previous, smaller array. It is kept alive because thieves may still be
+       reading from it. */
+    struct dill_pool_array *prev;
+    /* Power of two. */
+    int64_t size;
+    struct dill_pool_task *tasks[];
+};
+
+struct dill_pool_deque {
+    /* Stealing end. */
+    int64_t top __attribute__((aligned(DILL_CACHELINE)));
+    /* Owner's end. */
+    int64_t bottom __attribute__((aligned(DILL_CACHELINE)));
+    struct dill_pool_array *array __attribute__((aligned(DILL_CACHELINE)));
+};
+
+struct dill_pool;
+
+struct dill_pool_worker {
+    /* The deque is touched by other threads. Keep it at the beginning. */
+    struct dill_pool_deque deque;
+    /* Handle returned by poolself(). */
+    struct hvfs vfs;
+    int h;
+    struct dill_pool *pool;
+    pthread_t thread;
+    /* State of the random number generator used to pick victims. */
+    uint32_t seed;
+    /* Coroutines launched by this worker. */
+    struct dill_list running;
+    struct dill_list finished;
+    /* Following fields are used while the worker is idle. 'item' is in
+       pool's list of idle workers. 'rcl' is signaled when there's new work.
+       'lcl' is triggered by finished tasks. */
+    struct dill_list item;
+    struct dill_rcl rcl;
+    struct dill_clause lcl;
+    unsigned int listed : 1;
+    unsigned int parked : 1;
+} __attribute__((aligned(DILL_CACHELINE)));
+
+struct dill_pool {
+    /* Table of virtual functions. */
+    struct hvfs vfs;
+    int nworkers;
+    struct dill_pool_worker *workers;
+    /* Set once the pool is being closed. */
+    int stop;
+    /* Number of idle workers and number of tasks in 'tasks'. Used to avoid
+       taking the lock when not needed. */
+    int nidle;
+    int ntasks;
+    pthread_mutex_t lock;
+    /* Tasks submitted from outside of the pool. */
+    struct dill_list tasks;
+    /* Idle workers. */
+    struct dill_list idle;
+};
+
+static const int dill_pool_type_placeholder = 0;
+static const void *dill_pool_type = &dill_pool_type_placeholder;
+static void *dill_pool_query(struct hvfs *vfs, const void *type);
+static void dill_pool_close(struct hvfs *vfs);
+static void *dill_pool_wquery(struct hvfs *vfs, const void *type);
+static void dill_pool_wclose(struct hvfs *vfs);
+
+/* Worker running in the current thread, if any. */
+static pthread_key_t dill_pool_key;
+static pthread_once_t dill_pool_keyonce = PTHREAD_ONCE_INIT;
+
+static void dill_pool_makekey(void) {
+    int rc = pthread_key_create(&dill_pool_key, NULL);
+    dill_assert(!rc);
+}
+
+/******************************************************************************/
+/*  The deque.                                                                */
+/******************************************************************************/
+
+/* See N. M. Le, A. Pop, A. Cohen, F. Zappa Nardelli, "Correct and Efficient
+   Work-Stealing for Weak Memory Models" for the memory ordering. */
+
+static struct dill_pool_array *dill_pool_array(int64_t size) {
+    struct dill_pool_array *a = malloc(sizeof(struct dill_pool_array) +
+        size * sizeof(struct dill_pool_task*));
+    if(dill_slow(!a)) return NULL;
+    a->prev = NULL;
+    a->size = size;
+    return a;
+}
+
+static int dill_pool_dqinit(struct dill_pool_deque *dq) {
+    dq->top = 0;
+    dq->bottom = 0;
+    dq->array = dill_pool_array(64);
+    if(dill_slow(!dq->array)) {errno = ENOMEM; return -1;}
+    return 0;
+}
+
+/* Frees the deque along with the tasks that haven't been launched. */
+static void dill_pool_dqterm(struct dill_pool_deque *dq) {
+    struct dill_pool_array *a = dq->array;
+    int64_t i;
+    for(i = dq->top; i < dq->bottom; ++i)
+        free(a->tasks[i & (a->size - 1)]);
+    while(a) {
+        struct dill_pool_array *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+}
+
+/* Can be called only by the owner. */
+static int dill_pool_push(struct dill_pool_deque *dq,
+      struct dill_pool_task *t) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t tp = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    struct dill_pool_array *a = __atomic_load_n(&dq->array, __ATOMIC_RELAXED);
+    if(dill_slow(b - tp > a->size - 1)) {
+        struct dill_pool_array *na = dill_pool_array(a->size * 2);
+        if(dill_slow(!na)) {errno = ENOMEM; return -1;}
+        int64_t i;
+        for(i = tp; i < b; ++i)
+            na->tasks[i & (na->size - 1)] = __atomic_load_n(
+                &a->tasks[i & (a->size - 1)], __ATOMIC_RELAXED);
+        na->prev = a;
+        __atomic_store_n(&dq->array, na, __ATOMIC_RELEASE);
+        a = na;
+    }
+    __atomic_store_n(&a->tasks[b & (a->size - 1)], t, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Can be called only by the owner. */
+static struct dill_pool_task *dill_pool_pop(struct dill_pool_deque *dq) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    struct dill_pool_array *a = __atomic_load_n(&dq->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t tp = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+    if(tp > b) {
+        /* The deque is empty. */
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct dill_pool_task *t = __atomic_load_n(&a->tasks[b & (a->size - 1)],
+        __ATOMIC_RELAXED);
+    if(tp == b) {
+        /* Last item. Race with the thieves for it. */
+        if(!__atomic_compare_exchange_n(&dq->top, &tp, tp + 1, 0,
+              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            t = NULL;
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+/* Can be called by any thread. */
+static struct dill_pool_task *dill_pool_steal(struct dill_pool_deque *dq) {
+    int64_t tp = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if(tp >= b) return NULL;
+    struct dill_pool_array *a = __atomic_load_n(&dq->array, __ATOMIC_ACQUIRE);
+    struct dill_pool_task *t = __atomic_load_n(&a->tasks[tp & (a->size - 1)],
+        __ATOMIC_RELAXED);
+    /* Somebody else got the task first. */
+    if(!__atomic_compare_exchange_n(&dq->top, &tp, tp + 1, 0,
+          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return t;
+}
+
+static int dill_pool_dqempty(struct dill_pool_deque *dq) {
+    return __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE) >=
+        __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+}
+
+/******************************************************************************/
+/*  Scheduling the tasks.                                                     */
+/******************************************************************************/
+
+/* Wakes up one idle worker, if there is one. */
+static void dill_pool_wakeone(struct dill_pool *pool) {
+    /* Pairs with the fence in dill_pool_park(). Either we see the idle worker
+       or the worker sees the new task. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(dill_fast(!__atomic_load_n(&pool->nidle, __ATOMIC_RELAXED))) return;
+    pthread_mutex_lock(&pool->lock);
+    if(!dill_list_empty(&pool->idle)) {
+        struct dill_pool_worker *w = dill_cont(dill_list_next(&pool->idle),
+            struct dill_pool_worker, item);
+        dill_list_erase(&w->item);
+        w->listed = 0;
+        __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+        dill_pollset_signal(&w->rcl);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Gets a task to execute. Own deque is tried first, then the tasks submitted
+   from outside of the pool, then the deques of other workers. */
+static struct dill_pool_task *dill_pool_take(struct dill_pool_worker *w) {
+    struct dill_pool *pool = w->pool;
+    struct dill_pool_task *t = dill_pool_pop(&w->deque);
+    if(t) return t;
+    if(__atomic_load_n(&pool->ntasks, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&pool->lock);
+        if(!dill_list_empty(&pool->tasks)) {
+            t = dill_cont(dill_list_next(&pool->tasks), struct dill_pool_task,
+                item);
+            dill_list_erase(&t->item);
+            __atomic_sub_fetch(&pool->ntasks, 1, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if(t) return t;
+    }
+    /* Start at a random victim so that the thieves don't all contend for
+       the same deque. */
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    int n = pool->nworkers;
+    int start = w->seed % n;
+    int i;
+    for(i = 0; i != n; ++i) {
+        struct dill_pool_worker *victim = &pool->workers[(start + i) % n];
+        if(victim == w) continue;
+        t = dill_pool_steal(&victim->deque);
+        if(t) return t;
+    }
+    return NULL;
+}
+
+/* Returns 1 if there may be some work available for the worker. */
+static int dill_pool_haswork(struct dill_pool_worker *w) {
+    struct dill_pool *pool = w->pool;
+    if(__atomic_load_n(&pool->ntasks, __ATOMIC_ACQUIRE)) return 1;
+    int i;
+    for(i = 0; i != pool->nworkers; ++i)
+        if(!dill_pool_dqempty(&pool->workers[i].deque)) return 1;
+    return 0;
+}
+
+static coroutine void dill_pool_run(struct dill_pool_worker *w,
+      struct dill_pool_task *t) {
+    t->fn(t->arg);
+    /* The worker is shutting down and it will deallocate the task itself. */
+    if(t->closing) return;
+    dill_list_erase(&t->item);
+    dill_list_insert(&t->item, &w->finished);
+    /* Let the worker clean up the coroutine. */
+    if(w->parked) dill_trigger(&w->lcl, 0);
+}
+
+static void dill_pool_launch(struct dill_pool_worker *w,
+      struct dill_pool_task *t) {
+    t->closing = 0;
+    dill_list_insert(&t->item, &w->running);
+    /* The coroutine may finish before go() returns. That's fine, it won't be
+       reaped until the worker gets control back. */
+    int h = go(dill_pool_run(w, t));
+    if(dill_slow(h < 0)) {
+        /* Not enough memory for the stack. Execute the task in the worker's
+           own coroutine rather than dropping it. */
+        dill_list_erase(&t->item);
+        t->fn(t->arg);
+        free(t);
+        return;
+    }
+    t->h = h;
+}
+
+/* Deallocates the coroutines that have finished. */
+static void dill_pool_reap(struct dill_pool_worker *w) {
+    while(!dill_list_empty(&w->finished)) {
+        struct dill_pool_task *t = dill_cont(dill_list_next(&w->finished),
+            struct dill_pool_task, item);
+        dill_list_erase(&t->item);
+        int rc = hclose(t->h);
+        dill_assert(rc == 0);
+        free(t);
+    }
+}
+
+static void dill_pool_lcancel(struct dill_clause *cl) {
+    struct dill_pool_worker *w = dill_cont(cl, struct dill_pool_worker, lcl);
+    w->parked = 0;
+}
+
+/* Waits until there may be new work or until a task finishes. Coroutines
+   launched by the worker keep running in the meantime. */
+static void dill_pool_park(struct dill_pool_worker *w) {
+    struct dill_pool *pool = w->pool;
+    int rc = dill_pollset_rcl(&w->rcl);
+    if(dill_slow(rc < 0)) {
+        /* Can't be woken up from other threads. Poll for work instead. */
+        msleep(now() + 1);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if(dill_slow(pool->stop)) {
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    dill_list_insert(&w->item, &pool->idle);
+    w->listed = 1;
+    __atomic_add_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+    /* Pairs with the fence in dill_pool_wakeone(). */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(!dill_pool_haswork(w)) {
+        dill_pollset_remote(&w->rcl, 0);
+        dill_waitfor(&w->lcl, 1, NULL);
+        w->lcl.cancel = dill_pool_lcancel;
+        w->parked = 1;
+        dill_wait();
+    }
+    pthread_mutex_lock(&pool->lock);
+    if(w->listed) {
+        dill_list_erase(&w->item);
+        w->listed = 0;
+        __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *dill_pool_worker(void *arg) {
+    struct dill_pool_worker *w = arg;
+    int rc = pthread_setspecific(dill_pool_key, w);
+    dill_assert(rc == 0);
+    w->h = hmake(&w->vfs);
+    while(1) {
+        dill_pool_reap(w);
+        if(dill_slow(__atomic_load_n(&w->pool->stop, __ATOMIC_ACQUIRE)))
+            break;
+        struct dill_pool_task *t = dill_pool_take(w);
+        if(t) {
+            dill_pool_launch(w, t);
+            continue;
+        }
+        dill_pool_park(w);
+    }
+    /* Cancel the coroutines that are still running. */
+    while(!dill_list_empty(&w->running)) {
+        struct dill_pool_task *t = dill_cont(dill_list_next(&w->running),
+            struct dill_pool_task, item);
+        dill_list_erase(&t->item);
+        t->closing = 1;
+        rc = hclose(t->h);
+        dill_assert(rc == 0);
+        free(t);
+    }
+    dill_pool_reap(w);
+    if(w->h >= 0) {
+        rc = hclose(w->h);
+        dill_assert(rc == 0);
+    }
+    return NULL;
+}
+
+/******************************************************************************/
+/*  Pool creation and deallocation.                                           */
+/******************************************************************************/
+
+static void dill_pool_free(struct dill_pool *pool, int nworkers) {
+    int i;
+    for(i = 0; i != nworkers; ++i)
+        dill_pool_dqterm(&pool->workers[i].deque);
+    while(!dill_list_empty(&pool->tasks)) {
+        struct dill_pool_task *t = dill_cont(dill_list_next(&pool->tasks),
+            struct dill_pool_task, item);
+        dill_list_erase(&t->item);
+        free(t);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+/* Stops and joins the first 'nworkers' workers. */
+static void dill_pool_stop(struct dill_pool *pool, int nworkers) {
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    while(!dill_list_empty(&pool->idle)) {
+        struct dill_pool_worker *w = dill_cont(dill_list_next(&pool->idle),
+            struct dill_pool_worker, item);
+        dill_list_erase(&w->item);
+        w->listed = 0;
+        __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+        dill_pollset_signal(&w->rcl);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    int i;
+    for(i = 0; i != nworkers; ++i) {
+        int rc = pthread_join(pool->workers[i].thread, NULL);
+        dill_assert(rc == 0);
+    }
+}
+
+int poolmake(int nthreads) {
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(nthreads <= 0)) {errno = EINVAL; return -1;}
+    rc = pthread_once(&dill_pool_keyonce, dill_pool_makekey);
+    dill_assert(rc == 0);
+    struct dill_pool *pool = malloc(sizeof(struct dill_pool));
+    if(dill_slow(!pool)) {errno = ENOMEM; return -1;}
+    rc = posix_memalign((void**)&pool->workers, DILL_CACHELINE,
+        nthreads * sizeof(struct dill_pool_worker));
+    if(dill_slow(rc != 0)) {free(pool); errno = ENOMEM; return -1;}
+    rc = pthread_mutex_init(&pool->lock, NULL);
+    if(dill_slow(rc != 0)) {
+        free(pool->workers); free(pool); errno = ENOMEM; return -1;}
+    pool->vfs.query = dill_pool_query;
+    pool->vfs.close = dill_pool_close;
+    pool->nworkers = nthreads;
+    pool->stop = 0;
+    pool->nidle = 0;
+    pool->ntasks = 0;
+    dill_list_init(&pool->tasks);
+    dill_list_init(&pool->idle);
+    int i;
+    for(i = 0; i != nthreads; ++i) {
+        struct dill_pool_worker *w = &pool->workers[i];
+        rc = dill_pool_dqinit(&w->deque);
+        if(dill_slow(rc < 0)) {dill_pool_free(pool, i); return -1;}
+        w->vfs.query = dill_pool_wquery;
+        w->vfs.close = dill_pool_wclose;
+        w->h = -1;
+        w->pool = pool;
+        w->seed = 2654435761u * (i + 1);
+        dill_list_init(&w->running);
+        dill_list_init(&w->finished);
+        w->listed = 0;
+        w->parked = 0;
+    }
+    for(i = 0; i != nthreads; ++i) {
+        rc = pthread_create(&pool->workers[i].thread, NULL, dill_pool_worker,
+            &pool->workers[i]);
+        if(dill_slow(rc != 0)) {
+            dill_pool_stop(pool, i);
+            dill_pool_free(pool, nthreads);
+            errno = rc;
+            return -1;
+        }
+    }
+    int h = hmake(&pool->vfs);
+    if(dill_slow(h < 0)) {
+        int err = errno;
+        dill_pool_stop(pool, nthreads);
+        dill_pool_free(pool, nthreads);
+        errno = err;
+        return -1;
+    }
+    return h;
+}
+
+static void *dill_pool_query(struct hvfs *vfs, const void *type) {
+    if(dill_fast(type == dill_pool_type))
+        return dill_cont(vfs, struct dill_pool, vfs);
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static void dill_pool_close(struct hvfs *vfs) {
+    struct dill_pool *pool = dill_cont(vfs, struct dill_pool, vfs);
+    dill_pool_stop(pool, pool->nworkers);
+    dill_pool_free(pool, pool->nworkers);
+}
+
+static void *dill_pool_wquery(struct hvfs *vfs, const void *type) {
+    if(dill_fast(type == dill_pool_type))
+        return dill_cont(vfs, struct dill_pool_worker, vfs)->pool;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+/* The worker itself is deallocated along with the pool. */
+static void dill_pool_wclose(struct hvfs *vfs) {
+    struct dill_pool_worker *w = dill_cont(vfs, struct dill_pool_worker, vfs);
+    w->h = -1;
+}
+
+/******************************************************************************/
+/*  Submitting the tasks.                                                     */
+/******************************************************************************/
+
+int poolgo(int h, void (*fn)(void *arg), void *arg) {
+    struct dill_pool *pool = hquery(h, dill_pool_type);
+    if(dill_slow(!pool)) return -1;
+    if(dill_slow(!fn)) {errno = EINVAL; return -1;}
+    struct dill_pool_task *t = malloc(sizeof(struct dill_pool_task));
+    if(dill_slow(!t)) {errno = ENOMEM; return -1;}
+    t->fn = fn;
+    t->arg = arg;
+    /* If called from one of the pool's workers, push the task to the local
+       deque. The worker will execute it unless somebody steals it first. */
+    struct dill_pool_worker *w = pthread_getspecific(dill_pool_key);
+    if(w && w->pool == pool) {
+        int rc = dill_pool_push(&w->deque, t);
+        if(dill_slow(rc < 0)) {free(t); return -1;}
+    }
+    else {
+        pthread_mutex_lock(&pool->lock);
+        dill_list_insert(&t->item, &pool->tasks);
+        __atomic_add_fetch(&pool->ntasks, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    dill_pool_wakeone(pool);
+    return 0;
+}
+
+int poolself(void) {
+    int rc = pthread_once(&dill_pool_keyonce, dill_pool_makekey);
+    dill_assert(rc == 0);
+    struct dill_pool_worker *w = pthread_getspecific(dill_pool_key);
+    if(dill_slow(!w || w->h < 0)) {errno = EINVAL; return -1;}
+    return w->h;
+}
+
+#endif
@@ -24,24 +24,80 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
+#if defined DILL_THREADS
+#include <pthread.h>
+#endif
+
+#include "libdill.h"
 #include "stack.h"
 #include "utils.h"
 #include "ctx.h"
 
 /* The stacks are cached. The advantage is twofold. First, caching is
-   faster than malloc(). Second, it results in smaller number of calls to
-   mprotect(). */
+   faster than allocating a new stack. Second, it results in smaller number
+   of system calls. */
+
+/* Default stack size in bytes. */
+#define DILL_STACK_SIZE (256 * 1024)
+/* Default maximum number of unused cached stacks per size class. */
+#define DILL_MAX_CACHED_STACKS 64
+/* Number of pages at the top of the stack that are never trimmed. */
+#define DILL_STACK_HOT_PAGES 2
+/* Minimum interval between two trims on the idle path, in nanoseconds. */
+#define DILL_TRIM_INTERVAL 100000000
+
+#if !defined MAP_ANONYMOUS && defined MAP_ANON
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Stacks are allocated using one of the following methods:
+   - DILL_STACK_MMAP: Each stack is a separate anonymous mapping. Memory is
+     committed only as the pages are touched, so a mostly idle coroutine
+     uses just a few pages of physical memory. Bottom page of the mapping is
+     the guard page.
+   - DILL_STACK_MEMALIGN: Page-aligned heap allocation with the bottom page
+     used as the guard page.
+   - DILL_STACK_MALLOC: Plain heap allocation with no guard page. */
+#if HAVE_MMAP && defined MAP_ANONYMOUS && !defined DILL_NOMMAP
+#define DILL_STACK_MMAP
+#elif (HAVE_POSIX_MEMALIGN && HAVE_MPROTECT) & !defined DILL_NOGUARD
+#define DILL_STACK_MEMALIGN
+#else
+#define DILL_STACK_MALLOC
+#endif
 
-/* Stack size in bytes. */
-static size_t dill_stack_size = 256 * 1024;
-/* Maximum number of unused cached stacks. */
-static int dill_max_cached_stacks = 64;
+/* Stack arena is a bunch of big mappings carved into fixed-size slots.
+   Guard pages are installed using MADV_GUARD_INSTALL which, unlike
+   mprotect(), doesn't split the mapping. */
+#if HAVE_MMAP && defined MAP_ANONYMOUS
+#define DILL_ARENA
+#if defined __linux__ && !defined MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+#endif
+
+#if defined DILL_STACK_MMAP || defined DILL_ARENA
+/* Stacks don't need swap space reserved upfront. The memory is committed
+   as the stack grows. */
+#if defined MAP_NORESERVE
+#define DILL_MAP_NORESERVE MAP_NORESERVE
+#else
+#define DILL_MAP_NORESERVE 0
+#endif
+#if defined MAP_STACK
+#define DILL_MAP_STACK MAP_STACK
+#else
+#define DILL_MAP_STACK 0
+#endif
+#endif
 
 /* Returns smallest value greater than val that is a multiply of unit. */
 static size_t dill_align(size_t val, size_t unit) {
@@ -58,44 +114,67 @@ static size_t dill_page_size(void) {
     return (size_t)pgsz;
 }
 
-int dill_ctx_stack_init(struct dill_ctx_stack *ctx) {
-    ctx->count = 0;
-    dill_slist_init(&ctx->cache);
+/* Pattern placed at the bottom of stacks without a guard page. If it gets
+   overwritten the coroutine has overflown its stack. */
+static const uint8_t dill_canary[DILL_STACK_CANARY_SIZE] = {
+    0xde, 0xad, 0xbe, 0xef, 0x57, 0xac, 0x4b, 0x0f,
+    0xde, 0xad, 0xbe, 0xef, 0x57, 0xac, 0x4b, 0x0f};
+
+/* Size of the guard page, if any. */
+static size_t dill_guard_size(void) {
+#if defined DILL_STACK_MALLOC || \
+      (defined DILL_STACK_MMAP && defined DILL_NOGUARD)
     return 0;
+#else
+    return dill_page_size();
+#endif
 }
 
-void dill_ctx_stack_term(struct dill_ctx_stack *ctx) {
-    /* Deallocate leftover coroutines. */
-    struct dill_slist *it;
-    while((it = dill_slist_pop(&ctx->cache)) != &ctx->cache) {
-#if (HAVE_POSIX_MEMALIGN && HAVE_MPROTECT) & !defined DILL_NOGUARD
-        void *ptr = ((uint8_t*)(it + 1)) - dill_stack_size - dill_page_size();
-        int rc = mprotect(ptr, dill_page_size(), PROT_READ|PROT_WRITE);
-        dill_assert(rc == 0);
-        free(ptr);
+/* Size of the whole allocation, including the guard page. */
+static size_t dill_alloc_size(size_t size) {
+#if defined DILL_STACK_MALLOC
+    return size;
 #else
-        void *ptr = ((uint8_t*)(it + 1)) - dill_stack_size;
-        free(ptr);
+    return dill_align(size, dill_page_size()) + dill_guard_size();
 #endif
-    }
 }
 
-void *dill_allocstack(size_t *stack_size) {
-    struct dill_ctx_stack *ctx = &dill_getctx->stack;
-    if(stack_size)
-        *stack_size = dill_stack_size;
-    /* If there's a cached stack, use it. */
-    if(!dill_slist_empty(&ctx->cache)) {
-        --ctx->count;
-        return (void*)(dill_slist_pop(&ctx->cache) + 1);
+/* Returns size class of the stack or -1 if the stack is too big to be
+   cached. */
+static int dill_stack_class(size_t size) {
+    int cls;
+    for(cls = 0; cls != DILL_STACK_CLASSES; ++cls)
+        if(size <= ((size_t)DILL_STACK_MIN << cls)) return cls;
+    return -1;
+}
+
+size_t dill_stack_round(size_t size) {
+    int cls = dill_stack_class(size);
+    if(cls < 0) return dill_align(size, dill_page_size());
+    return (size_t)DILL_STACK_MIN << cls;
+}
+
+/* Allocates a new stack. Returns pointer to its top. */
+static void *dill_stack_alloc(size_t size) {
+    size_t sz = dill_alloc_size(size);
+#if defined DILL_STACK_MMAP
+    uint8_t *ptr = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+        MAP_ANONYMOUS | DILL_MAP_NORESERVE | DILL_MAP_STACK, -1, 0);
+    if(dill_slow(ptr == MAP_FAILED)) return NULL;
+#if !defined DILL_NOGUARD
+    /* The bottom page is used as a stack guard. This way stack overflow will
+       cause segfault rather than randomly overwrite other memory. */
+    int rc = mprotect(ptr, dill_guard_size(), PROT_NONE);
+    if(dill_slow(rc != 0)) {
+        int err = errno;
+        munmap(ptr, sz);
+        errno = err;
+        return NULL;
     }
-    /* Allocate a new stack. */
-    uint8_t *top;
-#if (HAVE_POSIX_MEMALIGN && HAVE_MPROTECT) & !defined DILL_NOGUARD
+#endif
+#elif defined DILL_STACK_MEMALIGN
     /* Allocate the stack so that it's memory-page-aligned.
        Add one page as stack overflow guard. */
-    size_t sz = dill_align(dill_stack_size, dill_page_size()) +
-        dill_page_size();
     uint8_t *ptr;
     int rc = posix_memalign((void**)&ptr, dill_page_size(), sz);
     if(dill_slow(rc != 0)) {
@@ -104,44 +183,672 @@ void *dill_allocstack(size_t *stack_size) {
     }
     /* The bottom page is used as a stack guard. This way stack overflow will
        cause segfault rather than randomly overwrite the heap. */
-    rc = mprotect(ptr, dill_page_size(), PROT_NONE);
+    rc = mprotect(ptr, dill_guard_size(), PROT_NONE);
     if(dill_slow(rc != 0)) {
         int err = errno;
         free(ptr);
         errno = err;
         return NULL;
     }
-    top = ptr + dill_page_size() + dill_stack_size;
 #else
     /* Simple allocation without a guard page. */
-    uint8_t *ptr = malloc(dill_stack_size);
+    uint8_t *ptr = malloc(sz);
     if(dill_slow(!ptr)) {
         errno = ENOMEM;
         return NULL;
     }
-    top = ptr + dill_stack_size;
+#endif
+    return ptr + sz;
+}
+
+/* Deallocates a stack. The argument is pointer to its top. */
+static void dill_stack_free(void *top, size_t size) {
+    size_t sz = dill_alloc_size(size);
+    uint8_t *ptr = (uint8_t*)top - sz;
+#if defined DILL_STACK_MMAP
+    int rc = munmap(ptr, sz);
+    dill_assert(rc == 0);
+#elif defined DILL_STACK_MEMALIGN
+    int rc = mprotect(ptr, dill_guard_size(), PROT_READ | PROT_WRITE);
+    dill_assert(rc == 0);
+    free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+#if defined DILL_ARENA
+
+/* Size of the mapping the arena slots are carved from. */
+#if SIZE_MAX > 0xffffffff
+#define DILL_ARENA_CHUNK ((size_t)256 * 1024 * 1024)
+#else
+#define DILL_ARENA_CHUNK ((size_t)16 * 1024 * 1024)
+#endif
+
+struct dill_stack_chunk {
+    struct dill_slist item;
+    void *base;
+    size_t size;
+};
+
+/* Size of the guard page of an arena slot. */
+static size_t dill_arena_guard_size(int mode) {
+#if defined DILL_NOGUARD
+    return 0;
+#else
+    return mode == STACKARENAGUARD ? dill_page_size() : 0;
+#endif
+}
+
+/* Carves a new slot from the arena. Returns pointer to its top. */
+static void *dill_arena_alloc(struct dill_ctx_stack *ctx, int cls,
+      int *flags) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    size_t size = (size_t)DILL_STACK_MIN << cls;
+    size_t slot = dill_align(size, dill_page_size()) +
+        dill_arena_guard_size(ctx->arena);
+    /* If the current chunk is exhausted, map a new one. */
+    if(dill_slow((size_t)(c->end - c->next) < slot)) {
+        size_t sz = DILL_ARENA_CHUNK / slot * slot;
+        if(sz == 0) sz = slot;
+        struct dill_stack_chunk *ch = malloc(sizeof(struct dill_stack_chunk));
+        if(dill_slow(!ch)) {errno = ENOMEM; return NULL;}
+        ch->base = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+            MAP_ANONYMOUS | DILL_MAP_NORESERVE | DILL_MAP_STACK, -1, 0);
+        if(dill_slow(ch->base == MAP_FAILED)) {
+            int err = errno;
+            free(ch);
+            errno = err;
+            return NULL;
+        }
+        ch->size = sz;
+        dill_slist_push(&ctx->chunks, &ch->item);
+        c->next = ch->base;
+        c->end = c->next + sz;
+    }
+    uint8_t *top = c->next + slot;
+    c->next = top;
+    *flags = DILL_STACK_ARENA;
+    if(ctx->arena == STACKARENACANARY) {
+        memcpy(top - size, dill_canary, DILL_STACK_CANARY_SIZE);
+        *flags |= DILL_STACK_CANARY;
+    }
+#if defined MADV_GUARD_INSTALL
+    else if(dill_arena_guard_size(ctx->arena)) {
+        int rc = madvise(top - slot, dill_page_size(), MADV_GUARD_INSTALL);
+        dill_assert(rc == 0);
+    }
 #endif
     return top;
 }
 
-void dill_freestack(void *stack) {
+#endif
+
+/* Gives the pages of an unused stack back to the operating system.
+   Top pages are kept as they are going to be touched straight away when
+   the stack is reused. The canary is kept as well. */
+static void dill_stack_advise(struct dill_ctx_stack *ctx, void *stack,
+      size_t stack_size, int flags) {
+#if HAVE_MADVISE
+    size_t pgsz = dill_page_size();
+    uintptr_t lo = (uintptr_t)stack - stack_size;
+    if(flags & DILL_STACK_CANARY) lo += DILL_STACK_CANARY_SIZE;
+    lo = dill_align(lo, pgsz);
+    uintptr_t hi = (uintptr_t)stack - DILL_STACK_HOT_PAGES * pgsz;
+    hi -= hi % pgsz;
+    if(hi <= lo) return;
+#if defined MADV_FREE
+    if(ctx->trimflags & STACKTRIMLAZY) {
+        int rc = madvise((void*)lo, hi - lo, MADV_FREE);
+        if(dill_fast(rc == 0)) return;
+        /* Not supported by the kernel. Fall back to MADV_DONTNEED. */
+        ctx->trimflags &= ~STACKTRIMLAZY;
+    }
+#endif
+    int rc = madvise((void*)lo, hi - lo, MADV_DONTNEED);
+    dill_assert(rc == 0);
+#endif
+}
+
+#if defined DILL_THREADS
+
+/* Process-wide pool of unused stacks. A thread that frees more stacks than
+   it can cache hands them over to the pool in batches. A thread that runs
+   out of cached stacks takes a batch from the pool before allocating new
+   stacks. Each size class is a bounded lock-free queue of batches, same as
+   the one used by cross-thread channels. Arena slots never get to the pool
+   given that the arena is unmapped when its thread exits. Stacks are trimmed
+   before they leave the thread, so that the pool holds at most
+   DILL_STACK_HOT_PAGES resident pages per stack. */
+
+/* Number of stacks in a batch. */
+#define DILL_STACK_BATCH 16
+/* Maximum number of batches in the pool, per size class. */
+#define DILL_STACK_POOL 64
+
+#define DILL_CACHELINE 64
+
+struct dill_stack_cell {
+    size_t seq;
+    /* First stack of the batch. The rest are linked via item.next. */
+    struct dill_stack_item *batch;
+};
+
+struct dill_stack_pool {
+    size_t enqpos __attribute__((aligned(DILL_CACHELINE)));
+    size_t deqpos __attribute__((aligned(DILL_CACHELINE)));
+    struct dill_stack_cell cells[DILL_STACK_POOL];
+};
+
+static struct dill_stack_pool dill_stack_pools[DILL_STACK_CLASSES];
+static pthread_once_t dill_stack_pools_once = PTHREAD_ONCE_INIT;
+
+static void dill_stack_pools_init(void) {
+    int i, j;
+    for(i = 0; i != DILL_STACK_CLASSES; ++i)
+        for(j = 0; j != DILL_STACK_POOL; ++j)
+            dill_stack_pools[i].cells[j].seq = j;
+}
+
+/* Returns 0 if the pool is full. */
+static int dill_stack_enqueue(struct dill_stack_pool *pool,
+      struct dill_stack_item *batch) {
+    size_t pos = __atomic_load_n(&pool->enqpos, __ATOMIC_RELAXED);
+    struct dill_stack_cell *cell;
+    while(1) {
+        cell = &pool->cells[pos % DILL_STACK_POOL];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if(dif == 0) {
+            if(__atomic_compare_exchange_n(&pool->enqpos, &pos, pos + 1, 1,
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(dif < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&pool->enqpos, __ATOMIC_RELAXED);
+    }
+    cell->batch = batch;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Returns NULL if the pool is empty. */
+static struct dill_stack_item *dill_stack_dequeue(
+      struct dill_stack_pool *pool) {
+    size_t pos = __atomic_load_n(&pool->deqpos, __ATOMIC_RELAXED);
+    struct dill_stack_cell *cell;
+    while(1) {
+        cell = &pool->cells[pos % DILL_STACK_POOL];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(dif == 0) {
+            if(__atomic_compare_exchange_n(&pool->deqpos, &pos, pos + 1, 1,
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(dif < 0)
+            return NULL;
+        else
+            pos = __atomic_load_n(&pool->deqpos, __ATOMIC_RELAXED);
+    }
+    struct dill_stack_item *batch = cell->batch;
+    __atomic_store_n(&cell->seq, pos + DILL_STACK_POOL, __ATOMIC_RELEASE);
+    return batch;
+}
+
+#define dill_stack_next(si) \
+    ((si)->item.next ? \
+    dill_cont((si)->item.next, struct dill_stack_item, item) : NULL)
+
+/* Adds the stack to the list of stacks to be handed to the pool. Nobody is
+   going to account for the memory of the stack from now on. Trim it. */
+static void dill_stack_out(struct dill_ctx_stack *ctx, int cls,
+      struct dill_stack_item *si) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    if(!(si->flags & DILL_STACK_TRIMMED)) {
+        dill_stack_advise(ctx, si + 1, (size_t)DILL_STACK_MIN << cls,
+            si->flags);
+        si->flags |= DILL_STACK_TRIMMED;
+    }
+    si->item.next = c->out ? &c->out->item : NULL;
+    c->out = si;
+    ++c->nout;
+}
+
+/* Deallocates the stacks in the out list. */
+static void dill_stack_drop(struct dill_ctx_stack *ctx, int cls) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    struct dill_stack_item *si = c->out;
+    c->out = NULL;
+    c->nout = 0;
+    while(si) {
+        struct dill_stack_item *next = dill_stack_next(si);
+        dill_stack_free(si + 1, (size_t)DILL_STACK_MIN << cls);
+        si = next;
+    }
+}
+
+/* Hands the stacks in the out list to the pool as a single batch. If the
+   pool is full the stacks are deallocated. */
+static void dill_stack_spill(struct dill_ctx_stack *ctx, int cls) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    if(!c->out) return;
+    if(dill_fast(dill_stack_enqueue(&dill_stack_pools[cls], c->out))) {
+        c->out = NULL;
+        c->nout = 0;
+        ++ctx->spills;
+        return;
+    }
+    ++ctx->spillmisses;
+    dill_stack_drop(ctx, cls);
+}
+
+/* Gets a batch of stacks, either from the out list or from the pool.
+   Returns the first stack of the batch and caches the rest. Returns NULL
+   if there are no stacks available. */
+static struct dill_stack_item *dill_stack_refill(struct dill_ctx_stack *ctx,
+      int cls) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    struct dill_stack_item *si = c->out;
+    if(si) {
+        c->out = NULL;
+        c->nout = 0;
+    }
+    else {
+        si = dill_stack_dequeue(&dill_stack_pools[cls]);
+        if(!si) {
+            ++ctx->refillmisses;
+            return NULL;
+        }
+        ++ctx->refills;
+    }
+    struct dill_stack_item *it = dill_stack_next(si);
+    while(it) {
+        struct dill_stack_item *next = dill_stack_next(it);
+        if(c->count < ctx->max) {
+            dill_slist_push(&c->cache, &it->item);
+            ++c->count;
+            if(!(it->flags & DILL_STACK_TRIMMED)) {
+                ++c->dirty;
+                ++ctx->dirty;
+            }
+        }
+        else {
+            dill_stack_out(ctx, cls, it);
+        }
+        it = next;
+    }
+    return si;
+}
+
+#endif
+
+/* Deallocates cached stacks in excess of max. Arena slots can't be
+   deallocated on their own so they are moved to the spare list. */
+static void dill_stack_trim(struct dill_ctx_stack *ctx, int cls, int max) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    while(c->count > max) {
+        struct dill_slist *it = dill_slist_pop(&c->cache);
+        struct dill_stack_item *si = dill_cont(it, struct dill_stack_item, item);
+        --c->count;
+        if(si->flags & DILL_STACK_ARENA) {
+            dill_slist_push(&c->spare, &si->item);
+            continue;
+        }
+        if(!(si->flags & DILL_STACK_TRIMMED)) {
+            --c->dirty;
+            --ctx->dirty;
+        }
+        dill_stack_free(si + 1, (size_t)DILL_STACK_MIN << cls);
+    }
+}
+
+/* Trims cached stacks in the size class so that at most keep of them
+   remain untrimmed. The stacks that were used most recently are kept. */
+static void dill_stack_trim_class(struct dill_ctx_stack *ctx, int cls,
+      int keep) {
+    struct dill_stack_class *c = &ctx->classes[cls];
+    size_t size = (size_t)DILL_STACK_MIN << cls;
+    /* Spare stacks are colder than the ones in the cache. */
+    struct dill_slist *lists[] = {&c->cache, &c->spare};
+    int kept = 0;
+    int i;
+    for(i = 0; i != 2 && c->dirty > keep; ++i) {
+        struct dill_slist *it;
+        for(it = dill_slist_next(lists[i]); it != lists[i] && c->dirty > keep;
+              it = dill_slist_next(it)) {
+            struct dill_stack_item *si =
+                dill_cont(it, struct dill_stack_item, item);
+            if(si->flags & DILL_STACK_TRIMMED) continue;
+            if(kept < keep) {
+                ++kept;
+                continue;
+            }
+            dill_stack_advise(ctx, si + 1, size, si->flags);
+            si->flags |= DILL_STACK_TRIMMED;
+            --c->dirty;
+            --ctx->dirty;
+        }
+    }
+}
+
+int dill_ctx_stack_init(struct dill_ctx_stack *ctx) {
+    ctx->size = DILL_STACK_SIZE;
+    ctx->cls = dill_stack_class(ctx->size);
+    ctx->max = DILL_MAX_CACHED_STACKS;
+    ctx->arena = STACKARENAOFF;
+    dill_slist_init(&ctx->chunks);
+    ctx->high = INT_MAX;
+    ctx->low = INT_MAX;
+    ctx->trimflags = 0;
+    ctx->dirty = 0;
+    ctx->last_trim = 0;
+    ctx->allocs = 0;
+    ctx->hits = 0;
+    ctx->refills = 0;
+    ctx->refillmisses = 0;
+    ctx->spills = 0;
+    ctx->spillmisses = 0;
+    int i;
+    for(i = 0; i != DILL_STACK_CLASSES; ++i) {
+        ctx->classes[i].count = 0;
+        ctx->classes[i].dirty = 0;
+        dill_slist_init(&ctx->classes[i].cache);
+        dill_slist_init(&ctx->classes[i].spare);
+        ctx->classes[i].next = NULL;
+        ctx->classes[i].end = NULL;
+        ctx->classes[i].out = NULL;
+        ctx->classes[i].nout = 0;
+    }
+#if defined DILL_THREADS
+    int rc = pthread_once(&dill_stack_pools_once, dill_stack_pools_init);
+    dill_assert(rc == 0);
+#endif
+    return 0;
+}
+
+void dill_ctx_stack_term(struct dill_ctx_stack *ctx) {
+    int i;
+#if defined DILL_THREADS
+    /* Hand the cached stacks over to the other threads. */
+    for(i = 0; i != DILL_STACK_CLASSES; ++i) {
+        struct dill_stack_class *c = &ctx->classes[i];
+        struct dill_slist *it;
+        while((it = dill_slist_pop(&c->cache)) != &c->cache) {
+            --c->count;
+            struct dill_stack_item *si =
+                dill_cont(it, struct dill_stack_item, item);
+            if(si->flags & DILL_STACK_ARENA) continue;
+            dill_stack_out(ctx, i, si);
+            if(c->nout == DILL_STACK_BATCH) dill_stack_spill(ctx, i);
+        }
+        dill_stack_spill(ctx, i);
+    }
+#endif
+    /* Deallocate leftover coroutines. */
+    for(i = 0; i != DILL_STACK_CLASSES; ++i)
+        dill_stack_trim(ctx, i, 0);
+#if defined DILL_ARENA
+    /* Unmap the arena. */
+    struct dill_slist *it;
+    while((it = dill_slist_pop(&ctx->chunks)) != &ctx->chunks) {
+        struct dill_stack_chunk *ch =
+            dill_cont(it, struct dill_stack_chunk, item);
+        int rc = munmap(ch->base, ch->size);
+        dill_assert(rc == 0);
+        free(ch);
+    }
+#endif
+}
+
+void *dill_allocstack(size_t *stack_size, int *flags) {
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    size_t size;
+    int cls;
+    if(!*stack_size) {
+        size = ctx->size;
+        cls = ctx->cls;
+    }
+    else {
+        size = dill_stack_round(*stack_size);
+        cls = dill_stack_class(size);
+    }
+    *stack_size = size;
+    ++ctx->allocs;
+    if(cls >= 0) {
+        /* If there's a cached stack, use it. */
+        struct dill_stack_class *c = &ctx->classes[cls];
+        struct dill_slist *it = NULL;
+        if(!dill_slist_empty(&c->cache)) {
+            --c->count;
+            it = dill_slist_pop(&c->cache);
+        }
+        else if(!dill_slist_empty(&c->spare)) {
+            it = dill_slist_pop(&c->spare);
+        }
+        if(it) {
+            struct dill_stack_item *si =
+                dill_cont(it, struct dill_stack_item, item);
+            if(!(si->flags & DILL_STACK_TRIMMED)) {
+                --c->dirty;
+                --ctx->dirty;
+            }
+            *flags = si->flags & ~DILL_STACK_TRIMMED;
+            ++ctx->hits;
+            return (void*)(si + 1);
+        }
+#if defined DILL_THREADS
+        /* Take a batch of stacks from the process-wide pool. */
+        struct dill_stack_item *si = dill_stack_refill(ctx, cls);
+        if(si) {
+            *flags = si->flags & ~DILL_STACK_TRIMMED;
+            ++ctx->hits;
+            return (void*)(si + 1);
+        }
+#endif
+#if defined DILL_ARENA
+        /* Carve a new stack from the arena. */
+        if(ctx->arena != STACKARENAOFF)
+            return dill_arena_alloc(ctx, cls, flags);
+#endif
+    }
+    /* Allocate a new stack. */
+    *flags = 0;
+    return dill_stack_alloc(size);
+}
+
+void dill_freestack(void *stack, size_t stack_size, int flags) {
     struct dill_ctx_stack *ctx = &dill_getctx->stack;
-    struct dill_slist *item = ((struct dill_slist*)stack) - 1;
-    /* If there are free slots in the cache put the stack to the cache. */
-    if(ctx->count < dill_max_cached_stacks) {
-        dill_slist_push(&ctx->cache, item);
-        ++ctx->count;
+    if(flags & DILL_STACK_CANARY)
+        dill_stack_check(stack, stack_size);
+    struct dill_stack_item *si = ((struct dill_stack_item*)stack) - 1;
+    si->flags = flags;
+    int cls = dill_stack_class(stack_size);
+    if(cls >= 0) {
+        /* If there are free slots in the cache put the stack to the cache. */
+        struct dill_stack_class *c = &ctx->classes[cls];
+        if(c->count < ctx->max) {
+            dill_slist_push(&c->cache, &si->item);
+            ++c->count;
+        }
+        /* Arena slots are never deallocated. */
+        else if(flags & DILL_STACK_ARENA) {
+            dill_slist_push(&c->spare, &si->item);
+        }
+        else {
+#if defined DILL_THREADS
+            /* Let other threads use the stack, unless the caching is
+               switched off altogether. */
+            if(dill_fast(ctx->max > 0)) {
+                dill_stack_out(ctx, cls, si);
+                if(c->nout == DILL_STACK_BATCH) dill_stack_spill(ctx, cls);
+                return;
+            }
+#endif
+            dill_stack_free(stack, stack_size);
+            return;
+        }
+        ++c->dirty;
+        ++ctx->dirty;
+        /* If there are too many untrimmed stacks, trim some of them. */
+        if(dill_slow(c->dirty > ctx->high))
+            dill_stack_trim_class(ctx, cls, ctx->low);
         return;
     }
     /* If the stack cache is full deallocate the stack. */
-#if (HAVE_POSIX_MEMALIGN && HAVE_MPROTECT) & !defined DILL_NOGUARD
-    void *ptr = ((uint8_t*)(item + 1)) - dill_stack_size - dill_page_size();
-    int rc = mprotect(ptr, dill_page_size(), PROT_READ|PROT_WRITE);
-    dill_assert(rc == 0);
-    free(ptr);
+    dill_stack_free(stack, stack_size);
+}
+
+void dill_stack_idle(void) {
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    if(dill_fast(ctx->dirty <= ctx->low)) return;
+    int64_t nw = dill_now();
+    if(nw - ctx->last_trim < DILL_TRIM_INTERVAL) return;
+    ctx->last_trim = nw;
+    int i;
+    for(i = 0; i != DILL_STACK_CLASSES; ++i)
+        dill_stack_trim_class(ctx, i, ctx->low);
+}
+
+void dill_stack_check(void *stack, size_t stack_size) {
+    uint8_t *bottom = (uint8_t*)stack - stack_size;
+    if(dill_slow(memcmp(bottom, dill_canary, DILL_STACK_CANARY_SIZE) != 0)) {
+        fprintf(stderr, "Coroutine stack overflow detected (%zu B stack)\n",
+            stack_size);
+        fflush(stderr);
+        abort();
+    }
+}
+
+#if HAVE_MINCORE
+
+/* Number of pages checked by a single mincore() call. */
+#define DILL_MINCORE_BATCH 64
+
+size_t dill_stack_used(void *stack, size_t stack_size, int flags) {
+    size_t pgsz = dill_page_size();
+    uintptr_t lo = (uintptr_t)stack - stack_size;
+    /* The canary is always resident. Ignore the page it's on. */
+    if(flags & DILL_STACK_CANARY) lo += DILL_STACK_CANARY_SIZE;
+    lo = dill_align(lo, pgsz);
+    uintptr_t hi = dill_align((uintptr_t)stack, pgsz);
+    /* Stack is used from the top down so the lowest resident page is
+       the high-water mark. Most of the stack is typically not resident so
+       scan from the bottom. */
+    unsigned char vec[DILL_MINCORE_BATCH];
+    uintptr_t pos = lo;
+    while(pos < hi) {
+        size_t n = (hi - pos) / pgsz;
+        if(n > DILL_MINCORE_BATCH) n = DILL_MINCORE_BATCH;
+        int rc = mincore((void*)pos, n * pgsz, (void*)vec);
+        if(dill_slow(rc != 0)) return 0;
+        size_t i;
+        for(i = 0; i != n && !(vec[i] & 1); ++i);
+        if(i != n) {
+            pos += i * pgsz;
+            break;
+        }
+        pos += n * pgsz;
+    }
+    if(pos >= (uintptr_t)stack) return 0;
+    return (uintptr_t)stack - pos;
+}
+
+#endif
+
+int stacksize(size_t size) {
+    if(dill_slow(size == 0)) {errno = EINVAL; return -1;}
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    ctx->size = dill_stack_round(size);
+    ctx->cls = dill_stack_class(ctx->size);
+    return 0;
+}
+
+int stackcache(int count) {
+    if(dill_slow(count < 0)) {errno = EINVAL; return -1;}
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    ctx->max = count;
+    int i;
+    for(i = 0; i != DILL_STACK_CLASSES; ++i) {
+        dill_stack_trim(ctx, i, count);
+#if defined DILL_THREADS
+        /* Stacks waiting to be handed to the pool are over the limit too. */
+        dill_stack_drop(ctx, i);
+#endif
+    }
+    return 0;
+}
+
+int stackarena(int mode) {
+    if(dill_slow(mode != STACKARENAOFF && mode != STACKARENAGUARD &&
+          mode != STACKARENACANARY)) {
+        errno = EINVAL; return -1;}
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    if(mode == ctx->arena) return 0;
+#if defined DILL_ARENA
+    if(dill_arena_guard_size(mode)) {
+#if defined MADV_GUARD_INSTALL
+        /* Check whether the kernel supports guard regions. */
+        size_t pgsz = dill_page_size();
+        void *ptr = mmap(NULL, pgsz * 2, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(dill_slow(ptr == MAP_FAILED)) return -1;
+        int rc = madvise(ptr, pgsz, MADV_GUARD_INSTALL);
+        munmap(ptr, pgsz * 2);
+        if(dill_slow(rc != 0)) {errno = ENOTSUP; return -1;}
 #else
-    void *ptr = ((uint8_t*)(item + 1)) - dill_stack_size;
-    free(ptr);
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+    /* Slot layout depends on the mode. Start carving from new chunks. */
+    int i;
+    for(i = 0; i != DILL_STACK_CLASSES; ++i) {
+        ctx->classes[i].next = NULL;
+        ctx->classes[i].end = NULL;
+    }
+    ctx->arena = mode;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
 #endif
 }
 
+int stacktrim(int high, int low, int flags) {
+    if(dill_slow(low < 0 || high < low || (flags & ~STACKTRIMLAZY))) {
+        errno = EINVAL; return -1;}
+#if !HAVE_MADVISE
+    errno = ENOTSUP;
+    return -1;
+#else
+#if !defined MADV_FREE
+    if(dill_slow(flags & STACKTRIMLAZY)) {errno = ENOTSUP; return -1;}
+#endif
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    ctx->high = high;
+    ctx->low = low;
+    ctx->trimflags = flags;
+    /* Apply the new high watermark straight away. */
+    int i;
+    for(i = 0; i != DILL_STACK_CLASSES; ++i)
+        if(ctx->classes[i].dirty > high)
+            dill_stack_trim_class(ctx, i, low);
+    return 0;
+#endif
+}
+
+int stackstats(struct stackstats *stats) {
+    if(dill_slow(!stats)) {errno = EINVAL; return -1;}
+    struct dill_ctx_stack *ctx = &dill_getctx->stack;
+    stats->allocs = ctx->allocs;
+    stats->hits = ctx->hits;
+    stats->refills = ctx->refills;
+    stats->refillmisses = ctx->refillmisses;
+    stats->spills = ctx->spills;
+    stats->spillmisses = ctx->spillmisses;
+    return 0;
+}
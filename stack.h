@@ -26,26 +26,115 @@
 #define DILL_STACK_INCLUDED
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "slist.h"
 
+/* Stack sizes are rounded up to size classes. Class N holds stacks of
+   DILL_STACK_MIN << N bytes. Stacks bigger than the largest class are
+   allocated and deallocated directly, without caching. */
+#define DILL_STACK_MIN 4096
+#define DILL_STACK_CLASSES 16
+
+/* Stack flags. */
+/* The stack is a slot in an arena. It can't be deallocated on its own. */
+#define DILL_STACK_ARENA 1
+/* The stack has no guard page. There's a canary at its bottom instead. */
+#define DILL_STACK_CANARY 2
+/* The stack is cached and its pages, except for the top ones, were given
+   back to the operating system. */
+#define DILL_STACK_TRIMMED 4
+
+/* Number of bytes at the bottom of the stack occupied by the canary. */
+#define DILL_STACK_CANARY_SIZE 16
+
+/* When the stack is cached this structure is placed on its top rather than
+   on the bottom. That way we minimise page misses. */
+struct dill_stack_item {
+    struct dill_slist item;
+    int flags;
+};
+
 /* A stack of unused coroutine stacks. This allows for extra-fast allocation
    of a new stack. The LIFO nature of this structure minimises cache misses.
-   When the stack is cached its dill_qlist_item is placed on its top rather
-   then on the bottom. That way we minimise page misses. */
-struct dill_ctx_stack {
+   Arena slots that don't fit into the cache are kept in the spare list.
+   Bump allocator carves new slots from the current arena chunk. */
+struct dill_stack_class {
     int count;
+    /* Number of cached stacks, including the spare ones, that were not
+       trimmed yet. */
+    int dirty;
     struct dill_slist cache;
+    struct dill_slist spare;
+    uint8_t *next;
+    uint8_t *end;
+    /* Stacks that don't fit into the cache, linked via item.next and
+       terminated by NULL. Once there's a batch of them, they are handed to
+       the process-wide pool. */
+    struct dill_stack_item *out;
+    int nout;
+};
+
+struct dill_ctx_stack {
+    /* Size of the stack used when no size is specified. */
+    size_t size;
+    /* Size class of the default stack size. */
+    int cls;
+    /* Maximum number of unused stacks cached in each size class. */
+    int max;
+    /* One of STACKARENA* constants. */
+    int arena;
+    /* Cached stacks are trimmed down to low watermark once there's more
+       than high watermark of them in a size class or when the thread gets
+       idle. */
+    int high;
+    int low;
+    /* STACKTRIM* flags. */
+    int trimflags;
+    /* Total number of untrimmed cached stacks. */
+    int dirty;
+    /* Time of the last trim on the idle path. */
+    int64_t last_trim;
+    /* Arena chunks, to be unmapped when the context is terminated. */
+    struct dill_slist chunks;
+    /* Statistics. See stackstats(). */
+    uint64_t allocs;
+    uint64_t hits;
+    uint64_t refills;
+    uint64_t refillmisses;
+    uint64_t spills;
+    uint64_t spillmisses;
+    struct dill_stack_class classes[DILL_STACK_CLASSES];
 };
 
 int dill_ctx_stack_init(struct dill_ctx_stack *ctx);
 void dill_ctx_stack_term(struct dill_ctx_stack *ctx);
 
+/* Rounds the stack size up to its size class. */
+size_t dill_stack_round(size_t size);
+
 /* Allocates new stack. Returns pointer to the *top* of the stack.
-   For now we assume that the stack grows downwards. */
-void *dill_allocstack(size_t *stack_size);
+   For now we assume that the stack grows downwards. On input stack_size
+   is the requested size, 0 meaning the default one. On output it is
+   the actual size of the stack. Stack flags are returned in flags. */
+void *dill_allocstack(size_t *stack_size, int *flags);
+
+/* Deallocates a stack. The arguments are pointer to the top of the stack,
+   the size and the flags returned by dill_allocstack(). */
+void dill_freestack(void *stack, size_t stack_size, int flags);
 
-/* Deallocates a stack. The argument is pointer to the top of the stack. */
-void dill_freestack(void *stack);
+/* Called by the scheduler before the thread goes to sleep. */
+void dill_stack_idle(void);
+
+/* Aborts the process if the canary at the bottom of the stack was
+   overwritten. */
+void dill_stack_check(void *stack, size_t stack_size);
+
+#if HAVE_MINCORE
+/* Returns the number of bytes at the top of the stack that are resident in
+   memory, at page granularity. Returns 0 if the residency can't be
+   determined. */
+size_t dill_stack_used(void *stack, size_t stack_size, int flags);
+#endif
 
 #endif
@@ -82,6 +82,32 @@ coroutine void receiver3(int ch) {
     errno_assert(rc == -1 && errno == EPIPE);
 }
 
+coroutine void vsender(int ch, int first, int n) {
+    int vals[n];
+    int i;
+    for(i = 0; i != n; ++i) vals[i] = first + i;
+    i = 0;
+    while(i != n) {
+        ssize_t sz = chsendv(ch, vals + i, n - i, -1);
+        errno_assert(sz > 0);
+        i += sz;
+    }
+}
+
+coroutine void vreceiver(int ch, int first, int n) {
+    int vals[n];
+    ssize_t sz = chrecvv(ch, vals, n, -1);
+    errno_assert(sz == n);
+    int i;
+    for(i = 0; i != n; ++i)
+        assert(vals[i] == first + i);
+}
+
+coroutine void ptrsender(int ch, void *ptr, size_t len) {
+    int rc = chsend_ptr(ch, ptr, len, -1);
+    errno_assert(rc == 0);
+}
+
 coroutine void cancel(int ch) {
     int val;
     int rc = chrecv(ch, &val, sizeof(val), -1);
@@ -312,6 +338,197 @@ int main() {
     rc = hclose(ch20);
     errno_assert(rc == 0);
 
+    /* Buffered channel: send doesn't block until the buffer is full. */
+    int ch21 = chmake_buf(sizeof(int), 3);
+    errno_assert(ch21 >= 0);
+    int i;
+    for(i = 0; i != 3; ++i) {
+        rc = chsend(ch21, &i, sizeof(i), 0);
+        errno_assert(rc == 0);
+    }
+    val = 3;
+    rc = chsend(ch21, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = chrecv(ch21, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    assert(val == 0);
+    /* The freed slot can be reused; items wrap around the ring. */
+    val = 3;
+    rc = chsend(ch21, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    for(i = 1; i != 4; ++i) {
+        rc = chrecv(ch21, &val, sizeof(val), 0);
+        errno_assert(rc == 0);
+        assert(val == i);
+    }
+    rc = chrecv(ch21, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+
+    /* Blocked sender gets its message into the buffer once there's space. */
+    val = 10;
+    rc = chsend(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    val = 11;
+    rc = chsend(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    val = 12;
+    rc = chsend(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    int hndl13 = go(sender(ch21, 0, 13));
+    errno_assert(hndl13 >= 0);
+    rc = yield();
+    errno_assert(rc == 0);
+    for(i = 10; i != 14; ++i) {
+        rc = chrecv(ch21, &val, sizeof(val), -1);
+        errno_assert(rc == 0);
+        assert(val == i);
+    }
+    rc = hclose(hndl13);
+    errno_assert(rc == 0);
+
+    /* Blocked receiver gets the message directly from the sender. */
+    int hndl14 = go(receiver(ch21, 42));
+    errno_assert(hndl14 >= 0);
+    rc = yield();
+    errno_assert(rc == 0);
+    val = 42;
+    rc = chsend(ch21, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    rc = hclose(hndl14);
+    errno_assert(rc == 0);
+
+    /* Buffered messages can be received after chdone(). */
+    val = 7;
+    rc = chsend(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    rc = chdone(ch21);
+    errno_assert(rc == 0);
+    rc = chsend(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = chrecv(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    assert(val == 7);
+    rc = chrecv(ch21, &val, sizeof(val), -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = hclose(ch21);
+    errno_assert(rc == 0);
+
+    /* Buffered channel with user-supplied storage. */
+    struct chmem mem2;
+    int buf[2];
+    int ch22 = chmake_buf_mem(sizeof(int), 2, &mem2, buf);
+    errno_assert(ch22 >= 0);
+    val = 1;
+    rc = chsend(ch22, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    val = 2;
+    rc = chsend(ch22, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    rc = chsend(ch22, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = chrecv(ch22, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    assert(val == 1);
+    rc = hclose(ch22);
+    errno_assert(rc == 0);
+    rc = chmake_buf_mem(sizeof(int), 2, &mem2, NULL);
+    errno_assert(rc == -1 && errno == EINVAL);
+
+    /* Batch receive drains the buffer and all the blocked senders. */
+    int ch23 = chmake_buf(sizeof(int), 4);
+    errno_assert(ch23 >= 0);
+    int vals[16];
+    ssize_t sz = chrecvv(ch23, vals, 16, 0);
+    errno_assert(sz == -1 && errno == ETIMEDOUT);
+    int hndl15[3];
+    hndl15[0] = go(sender(ch23, 0, 100));
+    errno_assert(hndl15[0] >= 0);
+    hndl15[1] = go(vsender(ch23, 101, 4));
+    errno_assert(hndl15[1] >= 0);
+    hndl15[2] = go(sender(ch23, 0, 105));
+    errno_assert(hndl15[2] >= 0);
+    rc = yield();
+    errno_assert(rc == 0);
+    sz = chrecvv(ch23, vals, 16, -1);
+    errno_assert(sz == 6);
+    for(i = 0; i != 6; ++i)
+        assert(vals[i] == 100 + i);
+    for(i = 0; i != 3; ++i) {
+        rc = hclose(hndl15[i]);
+        errno_assert(rc == 0);
+    }
+
+    /* Batch send fills the buffer and fails only if no item can be sent. */
+    for(i = 0; i != 6; ++i) vals[i] = i;
+    sz = chsendv(ch23, vals, 6, 0);
+    errno_assert(sz == 4);
+    sz = chsendv(ch23, vals + 4, 2, 0);
+    errno_assert(sz == -1 && errno == ETIMEDOUT);
+    sz = chrecvv(ch23, vals, 3, 0);
+    errno_assert(sz == 3);
+    assert(vals[0] == 0 && vals[1] == 1 && vals[2] == 2);
+    sz = chrecvv(ch23, vals, 16, 0);
+    errno_assert(sz == 1);
+    assert(vals[0] == 3);
+
+    /* Blocked batch receiver gets the rest of the batch once resumed. */
+    int hndl16 = go(vsender(ch23, 200, 10));
+    errno_assert(hndl16 >= 0);
+    int total = 0;
+    while(total != 10) {
+        sz = chrecvv(ch23, vals + total, 16 - total, -1);
+        errno_assert(sz > 0);
+        total += sz;
+    }
+    for(i = 0; i != 10; ++i)
+        assert(vals[i] == 200 + i);
+    rc = hclose(hndl16);
+    errno_assert(rc == 0);
+
+    /* A blocked batch sender hands over as many items as the receiver has
+       space for at once, and vice versa. */
+    hndl16 = go(vsender(ch23, 300, 10));
+    errno_assert(hndl16 >= 0);
+    sz = chrecvv(ch23, vals, 16, -1);
+    errno_assert(sz == 10);
+    for(i = 0; i != 10; ++i)
+        assert(vals[i] == 300 + i);
+    rc = hclose(hndl16);
+    errno_assert(rc == 0);
+    hndl16 = go(vreceiver(ch23, 400, 10));
+    errno_assert(hndl16 >= 0);
+    for(i = 0; i != 10; ++i) vals[i] = 400 + i;
+    sz = chsendv(ch23, vals, 10, -1);
+    errno_assert(sz == 10);
+    rc = hclose(hndl16);
+    errno_assert(rc == 0);
+    rc = chdone(ch23);
+    errno_assert(rc == 0);
+    sz = chrecvv(ch23, vals, 16, -1);
+    errno_assert(sz == -1 && errno == EPIPE);
+    sz = chsendv(ch23, vals, 16, -1);
+    errno_assert(sz == -1 && errno == EPIPE);
+    rc = hclose(ch23);
+    errno_assert(rc == 0);
+
+    /* Pointer channel passes the buffer itself, not a copy. */
+    int ch24 = chmake_ptr();
+    errno_assert(ch24 >= 0);
+    char frame[1000];
+    int hndl17 = go(ptrsender(ch24, frame, sizeof(frame)));
+    errno_assert(hndl17 >= 0);
+    void *ptr;
+    size_t len;
+    rc = chrecv_ptr(ch24, &ptr, &len, -1);
+    errno_assert(rc == 0);
+    assert(ptr == frame && len == sizeof(frame));
+    rc = hclose(hndl17);
+    errno_assert(rc == 0);
+    rc = chsend(ch24, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == EINVAL);
+    rc = hclose(ch24);
+    errno_assert(rc == 0);
+
     return 0;
 }
 
@@ -0,0 +1,228 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "assert.h"
+#include "../libdill.h"
+
+#define COUNT 100000
+
+struct args {
+    void *in;
+    void *out;
+};
+
+/* Sums the numbers received from 'in' and sends the result to 'out'. */
+void *adder(void *arg) {
+    struct args *args = arg;
+    int in = chimport(args->in);
+    errno_assert(in >= 0);
+    int out = chimport(args->out);
+    errno_assert(out >= 0);
+    long sum = 0;
+    while(1) {
+        int val;
+        int rc = chrecv(in, &val, sizeof(val), -1);
+        if(rc < 0 && errno == EPIPE) break;
+        errno_assert(rc == 0);
+        sum += val;
+    }
+    int rc = chsend(out, &sum, sizeof(sum), -1);
+    errno_assert(rc == 0);
+    rc = hclose(out);
+    errno_assert(rc == 0);
+    rc = hclose(in);
+    errno_assert(rc == 0);
+    return NULL;
+}
+
+/* Sleeps for a while then sends a value. */
+void *delayed(void *arg) {
+    int ch = chimport(arg);
+    errno_assert(ch >= 0);
+    int rc = msleep(now() + 50);
+    errno_assert(rc == 0);
+    int val = 42;
+    rc = chsend(ch, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    rc = hclose(ch);
+    errno_assert(rc == 0);
+    return NULL;
+}
+
+/* Sleeps for a while then calls chdone(). */
+void *finisher(void *arg) {
+    int ch = chimport(arg);
+    errno_assert(ch >= 0);
+    int rc = msleep(now() + 50);
+    errno_assert(rc == 0);
+    rc = chdone(ch);
+    errno_assert(rc == 0);
+    rc = hclose(ch);
+    errno_assert(rc == 0);
+    return NULL;
+}
+
+coroutine void blocked(int ch) {
+    int val;
+    int rc = chrecv(ch, &val, sizeof(val), -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+}
+
+int main() {
+    /* Single-threaded usage. */
+    int ch1 = chmake_mt(sizeof(int), 2);
+    errno_assert(ch1 >= 0);
+    int val = 1;
+    int rc = chsend(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    val = 2;
+    rc = chsend(ch1, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    rc = chsend(ch1, &val, sizeof(val), now() + 10);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = chrecv(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    assert(val == 1);
+    rc = chdone(ch1);
+    errno_assert(rc == 0);
+    rc = chsend(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = chrecv(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    assert(val == 2);
+    rc = chrecv(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = hclose(ch1);
+    errno_assert(rc == 0);
+    rc = chmake_mt(sizeof(int), 0);
+    errno_assert(rc == -1 && errno == EINVAL);
+
+    /* Channel with capacity of one. */
+    ch1 = chmake_mt(sizeof(int), 1);
+    errno_assert(ch1 >= 0);
+    val = 1;
+    rc = chsend(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    val = 2;
+    rc = chsend(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = chrecv(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    assert(val == 1);
+    rc = chrecv(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = chsend(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == 0);
+    rc = chsend(ch1, &val, sizeof(val), 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = hclose(ch1);
+    errno_assert(rc == 0);
+
+    /* Stream of messages to a different thread. The channel is small so that
+       both the sender and the receiver have to block once in a while. */
+    int caps[] = {4, 1};
+    int j;
+    for(j = 0; j != 2; ++j) {
+        int ch2 = chmake_mt(sizeof(int), caps[j]);
+        errno_assert(ch2 >= 0);
+        int ch3 = chmake_mt(sizeof(long), 1);
+        errno_assert(ch3 >= 0);
+        struct args args = {chexport(ch2), chexport(ch3)};
+        assert(args.in && args.out);
+        pthread_t t1;
+        rc = pthread_create(&t1, NULL, adder, &args);
+        errno_assert(rc == 0);
+        long expected = 0;
+        int i;
+        for(i = 0; i != COUNT; ++i) {
+            rc = chsend(ch2, &i, sizeof(i), -1);
+            errno_assert(rc == 0);
+            expected += i;
+        }
+        rc = chdone(ch2);
+        errno_assert(rc == 0);
+        long sum;
+        rc = chrecv(ch3, &sum, sizeof(sum), -1);
+        errno_assert(rc == 0);
+        assert(sum == expected);
+        rc = pthread_join(t1, NULL);
+        errno_assert(rc == 0);
+        rc = hclose(ch3);
+        errno_assert(rc == 0);
+        rc = hclose(ch2);
+        errno_assert(rc == 0);
+    }
+
+    /* Choose between a local channel and a cross-thread channel. */
+    int ch4 = chmake(sizeof(int));
+    errno_assert(ch4 >= 0);
+    int ch5 = chmake_mt(sizeof(int), 1);
+    errno_assert(ch5 >= 0);
+    pthread_t t2;
+    rc = pthread_create(&t2, NULL, delayed, chexport(ch5));
+    errno_assert(rc == 0);
+    struct chclause cls[] = {
+        {CHRECV, ch4, &val, sizeof(val)},
+        {CHRECV, ch5, &val, sizeof(val)}
+    };
+    rc = choose(cls, 2, now() + 5000);
+    choose_assert(1, 0);
+    assert(val == 42);
+    rc = pthread_join(t2, NULL);
+    errno_assert(rc == 0);
+    rc = hclose(ch5);
+    errno_assert(rc == 0);
+    rc = hclose(ch4);
+    errno_assert(rc == 0);
+
+    /* chdone() from a different thread unblocks the receiver. */
+    int ch6 = chmake_mt(sizeof(int), 1);
+    errno_assert(ch6 >= 0);
+    pthread_t t3;
+    rc = pthread_create(&t3, NULL, finisher, chexport(ch6));
+    errno_assert(rc == 0);
+    rc = chrecv(ch6, &val, sizeof(val), -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = pthread_join(t3, NULL);
+    errno_assert(rc == 0);
+    rc = hclose(ch6);
+    errno_assert(rc == 0);
+
+    /* Closing the handle unblocks the coroutines waiting on it. */
+    int ch7 = chmake_mt(sizeof(int), 1);
+    errno_assert(ch7 >= 0);
+    int hndl = go(blocked(ch7));
+    errno_assert(hndl >= 0);
+    rc = yield();
+    errno_assert(rc == 0);
+    rc = hclose(ch7);
+    errno_assert(rc == 0);
+    rc = hclose(hndl);
+    errno_assert(rc == 0);
+
+    return 0;
+}
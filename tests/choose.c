@@ -23,6 +23,7 @@
 */
 
 #include <stdio.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "../libdill.h"
@@ -364,6 +365,96 @@ int main() {
     rc = hclose(ch25);
     errno_assert(rc == 0);
 
+    /* Buffered channels. Send succeeds while there's space in the buffer,
+       receive succeeds while there are items in it, even after chdone(). */
+    int ch26 = chmake_buf(sizeof(int), 1);
+    errno_assert(ch26 >= 0);
+    val = 5;
+    struct chclause cls21[] = {{CHSEND, ch26, &val, sizeof(val)}};
+    rc = choose(cls21, 1, 0);
+    choose_assert(0, 0);
+    rc = choose(cls21, 1, 0);
+    choose_assert(-1, ETIMEDOUT);
+    rc = chdone(ch26);
+    errno_assert(rc == 0);
+    val = 0;
+    struct chclause cls22[] = {{CHRECV, ch26, &val, sizeof(val)}};
+    rc = choose(cls22, 1, 0);
+    choose_assert(0, 0);
+    assert(val == 5);
+    rc = choose(cls22, 1, 0);
+    choose_assert(0, EPIPE);
+    rc = hclose(ch26);
+    errno_assert(rc == 0);
+
+    /* Blocked choose on an empty buffered channel. */
+    int ch27 = chmake_buf(sizeof(int), 4);
+    errno_assert(ch27 >= 0);
+    int hndl14 = go(sender2(ch27, 1111));
+    errno_assert(hndl14 >= 0);
+    struct chclause cls23[] = {{CHRECV, ch27, &val, sizeof(val)}};
+    rc = choose(cls23, 1, -1);
+    choose_assert(0, 0);
+    assert(val == 1111);
+    rc = hclose(hndl14);
+    errno_assert(rc == 0);
+    rc = hclose(ch27);
+    errno_assert(rc == 0);
+
+    /* Waiting for file descriptors and channels at once. */
+    int fds[64][2];
+    struct chclause cls24[65];
+    for(i = 0; i != 64; ++i) {
+        rc = pipe(fds[i]);
+        errno_assert(rc == 0);
+        cls24[i].op = CHFDIN;
+        cls24[i].ch = fds[i][0];
+        cls24[i].val = NULL;
+        cls24[i].len = 0;
+    }
+    int ch28 = chmake(sizeof(int));
+    errno_assert(ch28 >= 0);
+    cls24[64].op = CHRECV;
+    cls24[64].ch = ch28;
+    cls24[64].val = &val;
+    cls24[64].len = sizeof(val);
+    rc = choose(cls24, 65, 0);
+    choose_assert(-1, ETIMEDOUT);
+    rc = choose(cls24, 65, now() + 10);
+    choose_assert(-1, ETIMEDOUT);
+    ssize_t sz = write(fds[42][1], "A", 1);
+    errno_assert(sz == 1);
+    rc = choose(cls24, 65, 0);
+    choose_assert(42, 0);
+    rc = choose(cls24, 65, -1);
+    choose_assert(42, 0);
+    char c;
+    sz = read(fds[42][0], &c, 1);
+    errno_assert(sz == 1);
+    int hndl15 = go(sender3(ch28, 2222, now() + 10));
+    errno_assert(hndl15 >= 0);
+    rc = choose(cls24, 65, -1);
+    choose_assert(64, 0);
+    assert(val == 2222);
+    rc = hclose(hndl15);
+    errno_assert(rc == 0);
+    struct chclause cls25[] = {{CHFDOUT, fds[0][1], NULL, 0},
+        {CHFDIN, -1, NULL, 0}};
+    rc = choose(cls25, 2, -1);
+    choose_assert(1, EBADF);
+    rc = choose(cls25, 1, -1);
+    choose_assert(0, 0);
+    rc = hclose(ch28);
+    errno_assert(rc == 0);
+    for(i = 0; i != 64; ++i) {
+        fdclean(fds[i][0]);
+        fdclean(fds[i][1]);
+        rc = close(fds[i][0]);
+        errno_assert(rc == 0);
+        rc = close(fds[i][1]);
+        errno_assert(rc == 0);
+    }
+
     return 0;
 }
 
@@ -22,9 +22,12 @@
 
 */
 
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <netinet/in.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -46,6 +49,94 @@ coroutine void trigger(int fd, int64_t deadline) {
     errno_assert(sz == 1);
 }
 
+coroutine void cancelread(int fd) {
+    char buf[16];
+    ssize_t sz = fdread(fd, buf, sizeof(buf), -1);
+    assert(sz == -1 && errno == ECANCELED);
+}
+
+coroutine void delayedwrite(int fd, int64_t deadline) {
+    int rc = msleep(deadline);
+    errno_assert(rc == 0);
+    ssize_t sz = fdwrite(fd, "hello", 5, -1);
+    errno_assert(sz == 5);
+}
+
+coroutine void connector(int port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    errno_assert(s >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int rc = connect(s, (struct sockaddr*)&addr, sizeof(addr));
+    errno_assert(rc == 0);
+    rc = close(s);
+    errno_assert(rc == 0);
+}
+
+static int counters[3] = {0, 0, 0};
+static int spurious = 0;
+
+coroutine void consumer(int fd, int id) {
+    while(1) {
+        int rc = fdin(fd, -1);
+        if(rc < 0 && errno == ECANCELED) return;
+        errno_assert(rc == 0);
+        char c;
+        ssize_t sz = recv(fd, &c, 1, 0);
+        if(sz < 0 && errno == EAGAIN) {++spurious; continue;}
+        errno_assert(sz == 1);
+        ++counters[id];
+    }
+}
+
+static int readers = 0;
+
+coroutine void readone(int fd) {
+    int rc = fdin(fd, -1);
+    errno_assert(rc == 0);
+    char c;
+    ssize_t sz = read(fd, &c, 1);
+    errno_assert(sz == 1);
+    ++readers;
+}
+
+/* Makes all the pipes readable at once and waits till the readers are done. */
+static void readall(int pipes[][2], int n) {
+    int hndls[n];
+    int i;
+    for(i = 0; i != n; ++i) {
+        hndls[i] = go(readone(pipes[i][0]));
+        errno_assert(hndls[i] >= 0);
+    }
+    int rc = yield();
+    errno_assert(rc == 0);
+    readers = 0;
+    for(i = 0; i != n; ++i) {
+        ssize_t sz = write(pipes[i][1], "A", 1);
+        errno_assert(sz == 1);
+    }
+    int64_t deadline = now() + 5000;
+    while(readers != n) {
+        assert(now() < deadline);
+        rc = msleep(now() + 10);
+        errno_assert(rc == 0);
+    }
+    for(i = 0; i != n; ++i) {
+        rc = hclose(hndls[i]);
+        errno_assert(rc == 0);
+    }
+}
+
+static void nonblock(int fd) {
+    int opt = fcntl(fd, F_GETFL, 0);
+    errno_assert(opt >= 0);
+    int rc = fcntl(fd, F_SETFL, opt | O_NONBLOCK);
+    errno_assert(rc == 0);
+}
+
 int main() {
     int rc;
 
@@ -130,6 +221,220 @@ int main() {
     rc = close(fds[0]);
     errno_assert(rc == 0);
 
+    /* Multiple coroutines waiting for the same fd. */
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    errno_assert(rc == 0);
+    nonblock(fds[0]);
+    rc = fdpolicy(-1, FDWAKEONE);
+    assert(rc == -1 && errno == EBADF);
+    rc = fdpolicy(fds[0], 7);
+    assert(rc == -1 && errno == EINVAL);
+    int consumers[3];
+    int i;
+    for(i = 0; i != 3; ++i) {
+        consumers[i] = go(consumer(fds[0], i));
+        errno_assert(consumers[i] >= 0);
+    }
+    rc = yield();
+    errno_assert(rc == 0);
+    /* By default, the waiters are resumed one by one in round-robin
+       fashion. */
+    for(i = 0; i != 6; ++i) {
+        nbytes = send(fds[1], "A", 1, 0);
+        errno_assert(nbytes == 1);
+        rc = msleep(now() + 10);
+        errno_assert(rc == 0);
+    }
+    assert(counters[0] == 2 && counters[1] == 2 && counters[2] == 2);
+    assert(spurious == 0);
+    /* Resume all the waiters. */
+    rc = fdpolicy(fds[0], FDWAKEALL);
+    errno_assert(rc == 0);
+    nbytes = send(fds[1], "A", 1, 0);
+    errno_assert(nbytes == 1);
+    rc = msleep(now() + 10);
+    errno_assert(rc == 0);
+    assert(counters[0] + counters[1] + counters[2] == 7);
+    assert(spurious == 2);
+    for(i = 0; i != 3; ++i) {
+        rc = hclose(consumers[i]);
+        errno_assert(rc == 0);
+    }
+    fdclean(fds[0]);
+    rc = close(fds[0]);
+    errno_assert(rc == 0);
+    rc = close(fds[1]);
+    errno_assert(rc == 0);
+
+    /* Tuning of the polling. */
+    rc = pollbatch(-1);
+    assert(rc == -1 && errno == EINVAL);
+    rc = pollinterval(0);
+    assert(rc == -1 && errno == EINVAL);
+    rc = pollstats(NULL);
+    assert(rc == -1 && errno == EINVAL);
+    struct pollstats st1, st2, st3;
+    rc = pollstats(&st1);
+    errno_assert(rc == 0);
+    assert(st1.batch == 128);
+    rc = pollinterval(10);
+    errno_assert(rc == 0);
+    for(i = 0; i != 1000; ++i) {
+        rc = yield();
+        errno_assert(rc == 0);
+    }
+    rc = pollstats(&st2);
+    errno_assert(rc == 0);
+    assert(st2.fairpolls - st1.fairpolls >= 90);
+    assert(st2.polls - st1.polls >= 90);
+    rc = pollinterval(103);
+    errno_assert(rc == 0);
+    int pipes[64][2];
+    for(i = 0; i != 64; ++i) {
+        rc = pipe(pipes[i]);
+        errno_assert(rc == 0);
+    }
+    rc = pollbatch(16);
+    errno_assert(rc == 0);
+    readall(pipes, 64);
+    rc = pollstats(&st2);
+    errno_assert(rc == 0);
+    assert(st2.batch == 16);
+    assert(st2.events - st1.events >= 64);
+    /* In adaptive mode, the batch grows when it's filled. Backends that
+       retrieve all the events at once never fill it. */
+    rc = pollbatch(0);
+    errno_assert(rc == 0);
+    readall(pipes, 64);
+    rc = pollstats(&st3);
+    errno_assert(rc == 0);
+    assert(st3.events - st2.events >= 64);
+    assert(st3.fullpolls == st2.fullpolls || st3.batch > 16);
+    for(i = 0; i != 64; ++i) {
+        fdclean(pipes[i][0]);
+        fdclean(pipes[i][1]);
+        rc = close(pipes[i][0]);
+        errno_assert(rc == 0);
+        rc = close(pipes[i][1]);
+        errno_assert(rc == 0);
+    }
+    rc = pollbatch(128);
+    errno_assert(rc == 0);
+
+    /* Busy-polling. */
+    rc = pollspin(-1, 0);
+    assert(rc == -1 && errno == EINVAL);
+    rc = pollspin(10, 2);
+    assert(rc == -1 && errno == EINVAL);
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    errno_assert(rc == 0);
+    rc = pollstats(&st1);
+    errno_assert(rc == 0);
+    rc = pollspin(1000000, POLLSPINSOCK);
+    errno_assert(rc == 0);
+    /* Spinning doesn't extend past the deadline. */
+    start = now();
+    rc = fdin(fds[0], start + 20);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    diff = now() - start;
+    assert(diff > 0 && diff < 200);
+    int hndl6 = go(trigger(fds[1], now() + 10));
+    errno_assert(hndl6 >= 0);
+    rc = fdin(fds[0], -1);
+    errno_assert(rc == 0);
+    rc = pollstats(&st2);
+    errno_assert(rc == 0);
+    assert(st2.spins > st1.spins);
+    assert(st2.spinhits > st1.spinhits);
+    assert(st2.spintime > st1.spintime);
+    rc = pollspin(0, 0);
+    errno_assert(rc == 0);
+    rc = hclose(hndl6);
+    errno_assert(rc == 0);
+    fdclean(fds[0]);
+    rc = close(fds[0]);
+    errno_assert(rc == 0);
+    rc = close(fds[1]);
+    errno_assert(rc == 0);
+
+    /* Completion-based I/O. */
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    errno_assert(rc == 0);
+    nonblock(fds[0]);
+    nonblock(fds[1]);
+    sz = fdread(-1, buf, sizeof(buf), -1);
+    assert(sz == -1 && errno == EBADF);
+    deadline = now() + 50;
+    sz = fdread(fds[0], buf, sizeof(buf), deadline);
+    assert(sz == -1 && errno == ETIMEDOUT);
+    diff = now() - deadline;
+    assert(diff > -20 && diff < 20);
+    sz = fdwrite(fds[1], "ABC", 3, -1);
+    errno_assert(sz == 3);
+    sz = fdread(fds[0], buf, sizeof(buf), -1);
+    errno_assert(sz == 3);
+    assert(memcmp(buf, "ABC", 3) == 0);
+    int hndl3 = go(delayedwrite(fds[1], now() + 20));
+    errno_assert(hndl3 >= 0);
+    sz = fdread(fds[0], buf, sizeof(buf), now() + 1000);
+    errno_assert(sz == 5);
+    assert(memcmp(buf, "hello", 5) == 0);
+    rc = hclose(hndl3);
+    errno_assert(rc == 0);
+    struct iovec iov[2] = {{"AB", 2}, {"CDE", 3}};
+    sz = fdwritev(fds[1], iov, 2, -1);
+    errno_assert(sz == 5);
+    char buf2[3];
+    struct iovec iov2[2] = {{buf, 2}, {buf2, 3}};
+    sz = fdreadv(fds[0], iov2, 2, -1);
+    errno_assert(sz == 5);
+    assert(memcmp(buf, "AB", 2) == 0 && memcmp(buf2, "CDE", 3) == 0);
+    int hndl4 = go(cancelread(fds[0]));
+    errno_assert(hndl4 >= 0);
+    rc = yield();
+    errno_assert(rc == 0);
+    rc = hclose(hndl4);
+    errno_assert(rc == 0);
+    fdclean(fds[1]);
+    rc = close(fds[1]);
+    errno_assert(rc == 0);
+    sz = fdread(fds[0], buf, sizeof(buf), -1);
+    errno_assert(sz == 0);
+    fdclean(fds[0]);
+    rc = close(fds[0]);
+    errno_assert(rc == 0);
+
+    /* Accepting connections. */
+    int lst = socket(AF_INET, SOCK_STREAM, 0);
+    errno_assert(lst >= 0);
+    nonblock(lst);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    rc = bind(lst, (struct sockaddr*)&addr, sizeof(addr));
+    errno_assert(rc == 0);
+    rc = listen(lst, 10);
+    errno_assert(rc == 0);
+    socklen_t addrlen = sizeof(addr);
+    rc = getsockname(lst, (struct sockaddr*)&addr, &addrlen);
+    errno_assert(rc == 0);
+    rc = fdaccept(lst, NULL, NULL, now() + 20);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    int hndl5 = go(connector(ntohs(addr.sin_port)));
+    errno_assert(hndl5 >= 0);
+    addrlen = sizeof(addr);
+    int s = fdaccept(lst, (struct sockaddr*)&addr, &addrlen, now() + 1000);
+    errno_assert(s >= 0);
+    assert(addrlen == sizeof(addr) && addr.sin_family == AF_INET);
+    rc = close(s);
+    errno_assert(rc == 0);
+    rc = hclose(hndl5);
+    errno_assert(rc == 0);
+    fdclean(lst);
+    rc = close(lst);
+    errno_assert(rc == 0);
+
     return 0;
 }
 
@@ -0,0 +1,85 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "../libdill.h"
+
+static int fd;
+static long threadrss;
+
+/* Touches a single fd and measures the memory while the thread's context
+   is still alive. */
+void *threadmain(void *arg) {
+    int rc = fdin(fd, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    threadrss = rss();
+    return NULL;
+}
+
+int main() {
+    /* Emulate a host with a huge limit on the number of fds, if allowed. */
+    struct rlimit rlim;
+    int rc = getrlimit(RLIMIT_NOFILE, &rlim);
+    errno_assert(rc == 0);
+    if(rlim.rlim_max != RLIM_INFINITY && rlim.rlim_max < 1048576) {
+        rlim.rlim_max = 1048576;
+        setrlimit(RLIMIT_NOFILE, &rlim);
+    }
+
+    /* Use a high-numbered fd in the main thread. */
+    int fds[2];
+    rc = pipe(fds);
+    errno_assert(rc == 0);
+    fd = dup2(fds[0], 1000);
+    errno_assert(fd == 1000);
+    rc = fdin(fd, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+
+    /* A new thread using one fd should cost little memory, regardless of
+       the limit on the number of fds. The thread's stack and libdill's
+       per-thread context take up about 100kB. */
+    long before = rss();
+    if(before < 0) return 0;
+    pthread_t t;
+    rc = pthread_create(&t, NULL, threadmain, NULL);
+    errno_assert(rc == 0);
+    rc = pthread_join(t, NULL);
+    errno_assert(rc == 0);
+    assert(threadrss >= 0);
+    assert(threadrss - before < 512 * 1024);
+
+    fdclean(fd);
+    rc = close(fd);
+    errno_assert(rc == 0);
+    rc = close(fds[0]);
+    errno_assert(rc == 0);
+    rc = close(fds[1]);
+    errno_assert(rc == 0);
+    return 0;
+}
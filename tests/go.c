@@ -23,10 +23,13 @@
 */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "assert.h"
+#include "mem.h"
 #include "../libdill.h"
 
 coroutine void dummy(void) {
@@ -64,6 +67,97 @@ coroutine void worker6(void) {
     assert(rc == -1 && errno == ECANCELED);
 }
 
+coroutine void where(char **addr) {
+    char c;
+    *addr = &c;
+}
+
+static int shared_sum = 0;
+
+/* Checks that the locals survive while other coroutines use the shared
+   stack. */
+coroutine void shared_worker(int id, int count) {
+    int vals[64];
+    int i, j;
+    for(i = 0; i != 64; ++i)
+        vals[i] = id * 1000 + i;
+    for(j = 0; j != count; ++j) {
+        int rc = yield();
+        errno_assert(rc == 0);
+        for(i = 0; i != 64; ++i)
+            assert(vals[i] == id * 1000 + i);
+    }
+    shared_sum += id;
+}
+
+coroutine void shared_deep(size_t len) {
+    volatile char buf[len];
+    size_t i;
+    for(i = 0; i < len; i += 512)
+        buf[i] = (char)i;
+    int rc = yield();
+    errno_assert(rc == 0);
+    for(i = 0; i < len; i += 512)
+        assert(buf[i] == (char)i);
+    shared_sum += 100;
+}
+
+coroutine void shared_parent(void) {
+    int hndls[3];
+    hndls[0] = go_shared(shared_worker(7, 3));
+    errno_assert(hndls[0] >= 0);
+    hndls[1] = go(shared_worker(8, 3));
+    errno_assert(hndls[1] >= 0);
+    hndls[2] = go_shared(shared_deep(10000));
+    errno_assert(hndls[2] >= 0);
+    int rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    int i;
+    for(i = 0; i != 3; ++i) {
+        rc = hclose(hndls[i]);
+        errno_assert(rc == 0);
+    }
+}
+
+/* Passes values stored on the stack back and forth. The peer is swapped out
+   of the shared stack while the message is being delivered. */
+coroutine void shared_pingpong(int ch, int first, int count) {
+    int i;
+    for(i = 0; i != count; ++i) {
+        int val = i;
+        if(first) {
+            int rc = chsend(ch, &val, sizeof(val), -1);
+            errno_assert(rc == 0);
+            rc = chrecv(ch, &val, sizeof(val), -1);
+            errno_assert(rc == 0);
+            assert(val == i * 2);
+        }
+        else {
+            int rc = chrecv(ch, &val, sizeof(val), -1);
+            errno_assert(rc == 0);
+            assert(val == i);
+            val *= 2;
+            rc = chsend(ch, &val, sizeof(val), -1);
+            errno_assert(rc == 0);
+        }
+    }
+    shared_sum += count;
+}
+
+/* Runs a burst of coroutines using lots of stack. */
+static void burst(void) {
+    int hndls[20];
+    int i;
+    for(i = 0; i != 20; ++i) {
+        hndls[i] = go(deep(200 * 1024, 0));
+        errno_assert(hndls[i] >= 0);
+    }
+    for(i = 0; i != 20; ++i) {
+        int rc = hclose(hndls[i]);
+        errno_assert(rc == 0);
+    }
+}
+
 int main() {
     /* Basic test. Run some coroutines. */
     int cr1 = go(worker(3, 7));
@@ -135,6 +229,216 @@ int main() {
     errno_assert(rc == 0);
     free(stack);
 
+    /* Test go_stack. */
+    cr1 = go_stack(deep(900 * 1024, 0), 1024 * 1024);
+    errno_assert(cr1 >= 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    cr1 = go_stack(deep(2048, 0), 4096);
+    errno_assert(cr1 >= 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+
+    /* Stacks of the same size class are reused. */
+    char *addr1, *addr2, *addr3;
+    cr1 = go_stack(where(&addr1), 10000);
+    errno_assert(cr1 >= 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    cr1 = go_stack(where(&addr2), 20000);
+    errno_assert(cr1 >= 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    cr1 = go_stack(where(&addr3), 16384);
+    errno_assert(cr1 >= 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    assert(addr1 == addr3);
+    assert(addr1 != addr2);
+
+    /* Test default stack size and cache depth. */
+    rc = stacksize(0);
+    assert(rc == -1 && errno == EINVAL);
+    rc = stackcache(-1);
+    assert(rc == -1 && errno == EINVAL);
+    rc = stacksize(1024 * 1024);
+    errno_assert(rc == 0);
+    cr1 = go(deep(900 * 1024, 0));
+    errno_assert(cr1 >= 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    rc = stackcache(0);
+    errno_assert(rc == 0);
+    for(i = 0; i != 20; ++i) {
+        hndls2[i] = go(worker3());
+        errno_assert(hndls2[i] >= 0);
+    }
+    for(i = 0; i != 20; ++i) {
+        rc = hclose(hndls2[i]);
+        errno_assert(rc == 0);
+    }
+    rc = stacksize(256 * 1024);
+    errno_assert(rc == 0);
+    rc = stackcache(64);
+    errno_assert(rc == 0);
+
+    /* Test stack arenas. More coroutines than fit into the cache. */
+    int modes[] = {STACKARENACANARY, STACKARENAGUARD, STACKARENAOFF};
+    int hndls3[100];
+    int j;
+    rc = stackarena(3);
+    assert(rc == -1 && errno == EINVAL);
+    for(j = 0; j != 3; ++j) {
+        rc = stackarena(modes[j]);
+        if(rc < 0) {
+            assert(errno == ENOTSUP);
+            continue;
+        }
+        for(i = 0; i != 100; ++i) {
+            hndls3[i] = go(worker(2, 1));
+            errno_assert(hndls3[i] >= 0);
+        }
+        hndls2[0] = go_stack(deep(10000, 0), 16384);
+        errno_assert(hndls2[0] >= 0);
+        rc = msleep(now() + 10);
+        errno_assert(rc == 0);
+        for(i = 0; i != 100; ++i) {
+            rc = hclose(hndls3[i]);
+            errno_assert(rc == 0);
+        }
+        rc = hclose(hndls2[0]);
+        errno_assert(rc == 0);
+    }
+
+    /* Test trimming of cached stacks on the idle path. */
+    rc = stacktrim(1, 2, 0);
+    assert(rc == -1 && errno == EINVAL);
+    rc = stacktrim(INT_MAX, 0, 0);
+    errno_assert(rc == 0);
+    burst();
+    long before = rss();
+    rc = msleep(now() + 50);
+    errno_assert(rc == 0);
+    long after = rss();
+    if(before >= 0)
+        assert(before - after > 20 * 150 * 1024);
+
+    /* Test trimming once the high watermark is hit. */
+    rc = stacktrim(4, 2, 0);
+    errno_assert(rc == 0);
+    before = rss();
+    burst();
+    after = rss();
+    if(before >= 0)
+        assert(after - before < 3 * 256 * 1024);
+
+    /* Lazy trimming. The memory is reclaimed only under memory pressure. */
+    rc = stacktrim(INT_MAX, 0, STACKTRIMLAZY);
+    if(rc == 0) {
+        burst();
+        rc = msleep(now() + 50);
+        errno_assert(rc == 0);
+        burst();
+    }
+    else {
+        assert(errno == ENOTSUP);
+    }
+    rc = stacktrim(INT_MAX, INT_MAX, 0);
+    errno_assert(rc == 0);
+
+    /* Test shared-stack coroutines. */
+    int hndls4[10];
+    for(i = 0; i != 10; ++i) {
+        hndls4[i] = go_shared(shared_worker(i + 1, 5));
+        errno_assert(hndls4[i] >= 0);
+    }
+    hndls2[0] = go_shared(shared_deep(100 * 1024));
+    errno_assert(hndls2[0] >= 0);
+    hndls2[1] = go(shared_worker(20, 5));
+    errno_assert(hndls2[1] >= 0);
+    rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    for(i = 0; i != 10; ++i) {
+        rc = hclose(hndls4[i]);
+        errno_assert(rc == 0);
+    }
+    rc = hclose(hndls2[0]);
+    errno_assert(rc == 0);
+    rc = hclose(hndls2[1]);
+    errno_assert(rc == 0);
+    assert(shared_sum == 55 + 100 + 20);
+
+    /* Shared-stack coroutine launching other coroutines. */
+    shared_sum = 0;
+    cr1 = go_shared(shared_parent());
+    errno_assert(cr1 >= 0);
+    cr2 = go_shared(shared_worker(1, 10));
+    errno_assert(cr2 >= 0);
+    rc = msleep(now() + 50);
+    errno_assert(rc == 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    rc = hclose(cr2);
+    errno_assert(rc == 0);
+    assert(shared_sum == 7 + 8 + 100 + 1);
+
+    /* Shared-stack coroutines talking over a channel. */
+    shared_sum = 0;
+    int ch = chmake(sizeof(int));
+    errno_assert(ch >= 0);
+    cr1 = go_shared(shared_pingpong(ch, 1, 100));
+    errno_assert(cr1 >= 0);
+    cr2 = go_shared(shared_pingpong(ch, 0, 100));
+    errno_assert(cr2 >= 0);
+    rc = msleep(now() + 50);
+    errno_assert(rc == 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    rc = hclose(cr2);
+    errno_assert(rc == 0);
+    rc = hclose(ch);
+    errno_assert(rc == 0);
+    assert(shared_sum == 200);
+
+    /* Canceling a blocked shared-stack coroutine. */
+    cr1 = go_shared(worker2());
+    errno_assert(cr1 >= 0);
+    cr2 = go_shared(worker2());
+    errno_assert(cr2 >= 0);
+    rc = yield();
+    errno_assert(rc == 0);
+    rc = hclose(cr1);
+    errno_assert(rc == 0);
+    rc = hclose(cr2);
+    errno_assert(rc == 0);
+
+    /* Test stack census. It's available only if compiled in. */
+    rc = stackcensus(NULL, -1);
+    assert(rc == -1 && errno == EINVAL);
+    rc = stackcensus(NULL, 0);
+    if(rc >= 0) {
+        int site = __LINE__ + 2;
+        for(i = 0; i != 3; ++i) {
+            cr1 = go_stack(deep(100000, 0), 256 * 1024);
+            errno_assert(cr1 >= 0);
+            rc = hclose(cr1);
+            errno_assert(rc == 0);
+        }
+        struct stackcensus items[64];
+        rc = stackcensus(items, 64);
+        errno_assert(rc > 0 && rc <= 64);
+        for(i = 0; i != rc; ++i)
+            if(items[i].line == site && strcmp(items[i].file, __FILE__) == 0)
+                break;
+        assert(i != rc);
+        assert(items[i].count == 3);
+        assert(items[i].maxstack >= 100000);
+        assert(items[i].maxstack <= 256 * 1024);
+    }
+    else {
+        assert(errno == ENOTSUP);
+    }
+
     return 0;
 }
 
@@ -29,19 +29,56 @@ int main(void) {
     struct dill_heap h;
     dill_heap_init(&h);
 
+    /* Items are popped in order of their values. */
     int64_t vals[10] = {1, 2, 3, 4, 15, 16, 33, 45, 46, 99};
+    struct dill_heap_item items[10];
     int i;
     for(i = 9; i >= 0; --i) {
-        int rc = dill_heap_push (&h, &vals[i]);
-        errno_assert(rc == 0);
+        items[i].val = vals[i];
+        dill_heap_push(&h, &items[i]);
     }
+    assert(h.count == 10);
     for(i = 0; i != 10; ++i) {
-        int64_t *p = dill_heap_pop(&h);
-        assert(p == &vals[i]);
+        struct dill_heap_item *p = dill_heap_pop(&h);
+        assert(p == &items[i]);
     }
-    int64_t *p = dill_heap_pop(&h);
+    struct dill_heap_item *p = dill_heap_pop(&h);
     assert(!p);
+    assert(dill_heap_empty(&h));
+
+    /* Items with equal values are popped in FIFO order. */
+    for(i = 0; i != 10; ++i) {
+        items[i].val = i < 5 ? 7 : 3;
+        dill_heap_push(&h, &items[i]);
+    }
+    for(i = 5; i != 10; ++i)
+        assert(dill_heap_pop(&h) == &items[i]);
+    for(i = 0; i != 5; ++i)
+        assert(dill_heap_pop(&h) == &items[i]);
+    assert(dill_heap_empty(&h));
+
+    /* Erasing items from the middle of the heap. */
+    for(i = 0; i != 10; ++i) {
+        items[i].val = vals[(i * 7) % 10];
+        dill_heap_push(&h, &items[i]);
+    }
+    /* Force the heap to restructure itself. */
+    p = dill_heap_pop(&h);
+    assert(p->val == 1);
+    for(i = 0; i != 10; ++i) {
+        if(&items[i] == p || items[i].val % 2) continue;
+        dill_heap_erase(&h, &items[i]);
+    }
+    int64_t last = -1;
+    while((p = dill_heap_pop(&h))) {
+        assert(p->val % 2);
+        assert(p->val > last);
+        last = p->val;
+    }
+    assert(last == 99);
+    assert(h.count == 0);
 
     dill_heap_term(&h);
     return 0;
 }
+
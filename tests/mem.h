@@ -0,0 +1,54 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef DILL_TESTS_MEM_INCLUDED
+#define DILL_TESTS_MEM_INCLUDED
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../libdill.h"
+
+/* Resident set size of the process in bytes, or -1 if not known. */
+static long rss(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if(!f) return -1;
+    long size, resident;
+    int rc = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if(rc != 2) return -1;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Touches 'len' bytes of stack. If 'block' is set, waits to be canceled
+   afterwards so that the stack can't be reused. */
+coroutine void deep(size_t len, int block) {
+    volatile char buf[len];
+    size_t i;
+    for(i = 0; i < len; i += 512)
+        buf[i] = 0;
+    if(block) msleep(-1);
+}
+
+#endif
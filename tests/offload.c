@@ -0,0 +1,116 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <unistd.h>
+
+#include "assert.h"
+#include "../libdill.h"
+
+static void slow(void *arg) {
+    int rc = usleep(100000);
+    errno_assert(rc == 0);
+    __atomic_add_fetch((int*)arg, 1, __ATOMIC_SEQ_CST);
+}
+
+coroutine void ticker(int *ticks) {
+    while(1) {
+        int rc = msleep(now() + 10);
+        if(rc < 0 && errno == ECANCELED) return;
+        errno_assert(rc == 0);
+        ++*ticks;
+    }
+}
+
+coroutine void offloader(int *done) {
+    int rc = offload(slow, done, -1);
+    errno_assert(rc == 0);
+}
+
+coroutine void canceled(int *done) {
+    int rc = offload(slow, done, -1);
+    errno_assert(rc == -1 && errno == ECANCELED);
+}
+
+int main() {
+    int rc = offload(NULL, NULL, -1);
+    errno_assert(rc == -1 && errno == EINVAL);
+
+    /* Other coroutines keep running while the function executes. */
+    int ticks = 0;
+    int hndl1 = go(ticker(&ticks));
+    errno_assert(hndl1 >= 0);
+    int done = 0;
+    rc = offload(slow, &done, -1);
+    errno_assert(rc == 0);
+    assert(done == 1);
+    assert(ticks >= 3);
+    rc = hclose(hndl1);
+    errno_assert(rc == 0);
+
+    /* Multiple functions run in parallel. The second burst finds four idle
+       threads and has to start four more. */
+    int hndls[8];
+    int bursts[] = {4, 8};
+    int i, j;
+    for(j = 0; j != 2; ++j) {
+        int expected = done + bursts[j];
+        int64_t start = now();
+        for(i = 0; i != bursts[j]; ++i) {
+            hndls[i] = go(offloader(&done));
+            errno_assert(hndls[i] >= 0);
+        }
+        while(__atomic_load_n(&done, __ATOMIC_SEQ_CST) != expected) {
+            assert(now() - start < 5000);
+            rc = msleep(now() + 10);
+            errno_assert(rc == 0);
+        }
+        assert(now() - start < 190);
+        for(i = 0; i != bursts[j]; ++i) {
+            rc = hclose(hndls[i]);
+            errno_assert(rc == 0);
+        }
+    }
+
+    /* Deadline expires while the function is running. The function keeps
+       running in the background. */
+    rc = offload(slow, &done, now() + 20);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    assert(done == 13);
+    rc = msleep(now() + 300);
+    errno_assert(rc == 0);
+    assert(__atomic_load_n(&done, __ATOMIC_SEQ_CST) == 14);
+
+    /* Closing the coroutine cancels the waiting. */
+    int hndl2 = go(canceled(&done));
+    errno_assert(hndl2 >= 0);
+    rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    rc = hclose(hndl2);
+    errno_assert(rc == 0);
+    rc = msleep(now() + 300);
+    errno_assert(rc == 0);
+    assert(__atomic_load_n(&done, __ATOMIC_SEQ_CST) == 15);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include "assert.h"
+#include "../libdill.h"
+
+#define COUNT 1000
+#define DEPTH 10
+
+/* Sends 1 to the channel. */
+void leaf(void *arg) {
+    int ch = chimport(arg);
+    errno_assert(ch >= 0);
+    int val = 1;
+    int rc = chsend(ch, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    rc = hclose(ch);
+    errno_assert(rc == 0);
+}
+
+/* Builds a binary tree of tasks. Each leaf sends 1 to the channel. */
+struct node {
+    void *ch;
+    int depth;
+};
+
+void tree(void *arg) {
+    struct node *n = arg;
+    int ch = chimport(n->ch);
+    errno_assert(ch >= 0);
+    int pool = poolself();
+    errno_assert(pool >= 0);
+    int i;
+    for(i = 0; i != 2; ++i) {
+        void *ref = chexport(ch);
+        assert(ref);
+        if(n->depth == 1) {
+            int rc = poolgo(pool, leaf, ref);
+            errno_assert(rc == 0);
+            continue;
+        }
+        struct node *child = malloc(sizeof(struct node));
+        assert(child);
+        child->ch = ref;
+        child->depth = n->depth - 1;
+        int rc = poolgo(pool, tree, child);
+        errno_assert(rc == 0);
+    }
+    int rc = hclose(ch);
+    errno_assert(rc == 0);
+    free(n);
+}
+
+/* Sleeps for a while then sends 1 to the channel. */
+void sleeper(void *arg) {
+    int rc = msleep(now() + 100);
+    errno_assert(rc == 0);
+    leaf(arg);
+}
+
+static int canceled = 0;
+
+/* Reports that it's running, then waits for a message that never comes. */
+void waiter(void *arg) {
+    void **refs = arg;
+    int in = chimport(refs[0]);
+    errno_assert(in >= 0);
+    int out = chimport(refs[1]);
+    errno_assert(out >= 0);
+    int val = 1;
+    int rc = chsend(out, &val, sizeof(val), -1);
+    errno_assert(rc == 0);
+    rc = chrecv(in, &val, sizeof(val), -1);
+    errno_assert(rc == -1 && errno == ECANCELED);
+    __atomic_add_fetch(&canceled, 1, __ATOMIC_SEQ_CST);
+    rc = hclose(out);
+    errno_assert(rc == 0);
+    rc = hclose(in);
+    errno_assert(rc == 0);
+    free(refs);
+}
+
+static void collect(int ch, int n) {
+    int i;
+    for(i = 0; i != n; ++i) {
+        int val;
+        int rc = chrecv(ch, &val, sizeof(val), now() + 10000);
+        errno_assert(rc == 0);
+        assert(val == 1);
+    }
+}
+
+int main() {
+    int rc = poolmake(0);
+    errno_assert(rc == -1 && errno == EINVAL);
+    rc = poolself();
+    errno_assert(rc == -1 && errno == EINVAL);
+
+    /* Tasks submitted from outside of the pool. */
+    int pool = poolmake(4);
+    errno_assert(pool >= 0);
+    int ch = chmake_mt(sizeof(int), 16);
+    errno_assert(ch >= 0);
+    int i;
+    for(i = 0; i != COUNT; ++i) {
+        rc = poolgo(pool, leaf, chexport(ch));
+        errno_assert(rc == 0);
+    }
+    collect(ch, COUNT);
+
+    /* Tasks submitted from within the pool. */
+    struct node *root = malloc(sizeof(struct node));
+    assert(root);
+    root->ch = chexport(ch);
+    root->depth = DEPTH;
+    rc = poolgo(pool, tree, root);
+    errno_assert(rc == 0);
+    collect(ch, 1 << DEPTH);
+
+    /* Blocked tasks don't prevent other tasks from running. */
+    int64_t start = now();
+    for(i = 0; i != 100; ++i) {
+        rc = poolgo(pool, sleeper, chexport(ch));
+        errno_assert(rc == 0);
+    }
+    collect(ch, 100);
+    assert(now() - start < 2000);
+
+    /* Closing the pool cancels the running tasks. */
+    int blk = chmake_mt(sizeof(int), 1);
+    errno_assert(blk >= 0);
+    for(i = 0; i != 8; ++i) {
+        void **refs = malloc(2 * sizeof(void*));
+        assert(refs);
+        refs[0] = chexport(blk);
+        refs[1] = chexport(ch);
+        rc = poolgo(pool, waiter, refs);
+        errno_assert(rc == 0);
+    }
+    collect(ch, 8);
+    rc = hclose(pool);
+    errno_assert(rc == 0);
+    assert(canceled == 8);
+    rc = hclose(blk);
+    errno_assert(rc == 0);
+    rc = hclose(ch);
+    errno_assert(rc == 0);
+
+    return 0;
+}
@@ -44,9 +44,24 @@ int main() {
     int64_t diff = now () - deadline;
     assert(diff > -20 && diff < 20);
 
-    /* msleep-sort */
+    /* Test 'nsleep' with sub-millisecond deadline. */
+    int64_t ndeadline = now_ns() + 300000;
+    rc = nsleep(ndeadline);
+    errno_assert(rc == 0);
+    int64_t ndiff = now_ns() - ndeadline;
+    assert(ndiff >= 0 && ndiff < 20000000);
+
+    /* Sub-millisecond timeout. */
     int ch = chmake(sizeof(int));
     errno_assert(ch >= 0);
+    int val;
+    ndeadline = now_ns() + 200000;
+    rc = chrecv_ns(ch, &val, sizeof(val), ndeadline);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    ndiff = now_ns() - ndeadline;
+    assert(ndiff >= 0 && ndiff < 20000000);
+
+    /* msleep-sort */
     int hndls[4];
     hndls[0] = go(delay(30, ch));
     errno_assert(hndls[0] >= 0);
@@ -56,7 +71,6 @@ int main() {
     errno_assert(hndls[2] >= 0);
     hndls[3] = go(delay(20, ch));
     errno_assert(hndls[3] >= 0);
-    int val;
     rc = chrecv(ch, &val, sizeof(val), -1);
     errno_assert(rc == 0);
     assert(val == 10);
@@ -22,10 +22,12 @@
 
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <pthread.h>
 
 #include "assert.h"
+#include "mem.h"
 #include "../libdill.h"
 
 coroutine void worker(int count, const char *text) {
@@ -37,6 +39,33 @@ coroutine void worker(int count, const char *text) {
     }
 }
 
+coroutine void nop(void) {
+}
+
+#define NSTACKS 200
+
+/* Frees more stacks than fit into the thread's cache. */
+void *spiller(void *arg) {
+    int hndls[NSTACKS];
+    int i;
+    for(i = 0; i != NSTACKS; ++i) {
+        hndls[i] = go(nop());
+        errno_assert(hndls[i] >= 0);
+    }
+    for(i = 0; i != NSTACKS; ++i) {
+        int rc = hclose(hndls[i]);
+        errno_assert(rc == 0);
+    }
+    struct stackstats st;
+    int rc = stackstats(&st);
+    errno_assert(rc == 0);
+    assert(st.allocs == NSTACKS);
+    assert(st.spills > 0);
+    return NULL;
+}
+
+#define NDEEP 1000
+
 /* This function is run by thread t1. */
 void *threadmain(void *arg)
 {
@@ -77,5 +106,54 @@ int main() {
     errno_assert(rc == 0);
     rc = pthread_join(t1, NULL);
     errno_assert(rc == 0);
+
+    /* Stacks freed by one thread are reused by another one. */
+    rc = pthread_create(&t1, NULL, spiller, NULL);
+    errno_assert(rc == 0);
+    rc = pthread_join(t1, NULL);
+    errno_assert(rc == 0);
+    struct stackstats st1, st2;
+    rc = stackstats(&st1);
+    errno_assert(rc == 0);
+    int hndls[NSTACKS];
+    int i;
+    for(i = 0; i != NSTACKS; ++i) {
+        hndls[i] = go(nop());
+        errno_assert(hndls[i] >= 0);
+    }
+    for(i = 0; i != NSTACKS; ++i) {
+        rc = hclose(hndls[i]);
+        errno_assert(rc == 0);
+    }
+    rc = stackstats(&st2);
+    errno_assert(rc == 0);
+    assert(st2.allocs - st1.allocs == NSTACKS);
+    assert(st2.refills > st1.refills);
+    assert(st2.hits - st1.hits == NSTACKS);
+    rc = stackstats(NULL);
+    assert(rc == -1 && errno == EINVAL);
+
+    /* Memory of the stacks handed to the pool is given back to the system.
+       Same for the cached stacks once they are trimmed. */
+    long before = rss();
+    int hndls2[NDEEP];
+    for(i = 0; i != NDEEP; ++i) {
+        hndls2[i] = go(deep(100 * 1024, 1));
+        errno_assert(hndls2[i] >= 0);
+    }
+    for(i = 0; i != NDEEP; ++i) {
+        rc = hclose(hndls2[i]);
+        errno_assert(rc == 0);
+    }
+    rc = stacktrim(0, 0, 0);
+    errno_assert(rc == 0);
+    long after = rss();
+    if(before >= 0)
+        assert(after - before < 16 * 1024 * 1024);
+    rc = stackcache(0);
+    errno_assert(rc == 0);
+    after = rss();
+    if(before >= 0)
+        assert(after - before < 16 * 1024 * 1024);
     return 0;
 }
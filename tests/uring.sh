@@ -0,0 +1,8 @@
+#!/bin/sh
+
+# Runs the fd tests with io_uring. Skipped if the kernel doesn't provide it.
+
+DILL_POLLER=io_uring
+export DILL_POLLER
+./tests/example >/dev/null 2>&1 || exit 77
+./tests/fd && ./tests/choose
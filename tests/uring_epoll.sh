@@ -0,0 +1,7 @@
+#!/bin/sh
+
+# Runs the fd tests with the epoll fallback of the io_uring build.
+
+DILL_POLLER=epoll
+export DILL_POLLER
+./tests/fd && ./tests/choose
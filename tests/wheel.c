@@ -0,0 +1,96 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include "assert.h"
+#include "../wheel.c"
+
+int main(void) {
+    struct dill_wheel w;
+    dill_wheel_init(&w, 1000);
+    assert(dill_wheel_empty(&w));
+    assert(dill_wheel_next(&w) == -1);
+    assert(!dill_wheel_top(&w, 2000));
+
+    /* Items expire in order of their deadlines, across all the levels. */
+    int64_t vals[10] = {2001, 2002, 2010, 2100, 3000, 7000, 70000, 500000,
+        30000000, 100000000000};
+    struct dill_wheel_item items[10];
+    int i;
+    for(i = 9; i >= 0; --i) {
+        items[i].val = vals[i];
+        dill_wheel_add(&w, &items[i]);
+    }
+    assert(!dill_wheel_top(&w, 2000));
+    for(i = 0; i != 10; ++i) {
+        /* The wheel never asks to be woken up after the next expiry. */
+        assert(dill_wheel_next(&w) <= vals[i]);
+        assert(!dill_wheel_top(&w, vals[i] - 1));
+        struct dill_wheel_item *p = dill_wheel_top(&w, vals[i]);
+        assert(p == &items[i]);
+        dill_wheel_erase(&w, p);
+    }
+    assert(dill_wheel_empty(&w));
+
+    /* Items with equal deadlines expire in FIFO order, even if they were
+       added at different levels. */
+    int64_t base = w.cur;
+    for(i = 0; i != 10; ++i) {
+        items[i].val = base + 5000;
+        dill_wheel_add(&w, &items[i]);
+        assert(!dill_wheel_top(&w, base + 500 * i));
+    }
+    for(i = 0; i != 10; ++i) {
+        struct dill_wheel_item *p = dill_wheel_top(&w, base + 5000);
+        assert(p == &items[i]);
+        dill_wheel_erase(&w, p);
+    }
+    assert(dill_wheel_empty(&w));
+
+    /* Deadlines in the past expire immediately. */
+    items[0].val = 0;
+    dill_wheel_add(&w, &items[0]);
+    assert(dill_wheel_next(&w) < w.cur);
+    assert(dill_wheel_top(&w, w.cur - 1) == &items[0]);
+    dill_wheel_erase(&w, &items[0]);
+
+    /* Erased items never expire. */
+    base = w.cur;
+    for(i = 0; i != 10; ++i) {
+        items[i].val = base + i * 100;
+        dill_wheel_add(&w, &items[i]);
+    }
+    for(i = 0; i != 10; i += 2)
+        dill_wheel_erase(&w, &items[i]);
+    for(i = 1; i < 10; i += 2) {
+        struct dill_wheel_item *p = dill_wheel_top(&w, base + 10000);
+        assert(p == &items[i]);
+        dill_wheel_erase(&w, p);
+    }
+    assert(!dill_wheel_top(&w, base + 10000));
+    assert(dill_wheel_empty(&w));
+
+    dill_wheel_term(&w);
+    return 0;
+}
+
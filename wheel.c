@@ -0,0 +1,177 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+#include "utils.h"
+#include "wheel.h"
+
+#define DILL_WHEEL_MASK (DILL_WHEEL_SLOTS - 1)
+
+/* Range covered by one slot on the level. */
+#define dill_wheel_span(level) (((int64_t)1) << ((level) * DILL_WHEEL_BITS))
+
+void dill_wheel_init(struct dill_wheel *self, int64_t now) {
+    self->cur = now;
+    self->count = 0;
+    int i, j;
+    for(i = 0; i != DILL_WHEEL_LEVELS; ++i) {
+        self->bitmaps[i] = 0;
+        for(j = 0; j != DILL_WHEEL_SLOTS; ++j)
+            dill_list_init(&self->slots[i][j]);
+    }
+    dill_list_init(&self->overflow);
+    dill_list_init(&self->expired);
+}
+
+void dill_wheel_term(struct dill_wheel *self) {
+    /* The items are owned by the user. There's nothing to deallocate. */
+}
+
+/* Puts the item into the appropriate slot, given the current time of the
+   wheel. Doesn't touch the item count. */
+static void dill_wheel_place(struct dill_wheel *self,
+      struct dill_wheel_item *item) {
+    /* The ticks before 'cur' were already processed. */
+    if(dill_slow(item->val < self->cur)) {
+        item->level = -1;
+        item->slot = 0;
+        dill_list_insert(&item->item, &self->expired);
+        return;
+    }
+    int64_t val = item->val;
+    /* Find the lowest level where deadline and current time share the
+       block. That's given by the highest bit in which they differ. */
+    uint64_t diff = (uint64_t)val ^ (uint64_t)self->cur;
+    int level = diff ? (63 - __builtin_clzll(diff)) / DILL_WHEEL_BITS : 0;
+    if(dill_slow(level >= DILL_WHEEL_LEVELS)) {
+        item->level = DILL_WHEEL_LEVELS;
+        item->slot = 0;
+        dill_list_insert(&item->item, &self->overflow);
+        return;
+    }
+    int slot = (int)((val >> (level * DILL_WHEEL_BITS)) & DILL_WHEEL_MASK);
+    item->level = level;
+    item->slot = slot;
+    dill_list_insert(&item->item, &self->slots[level][slot]);
+    self->bitmaps[level] |= ((uint64_t)1) << slot;
+}
+
+void dill_wheel_add(struct dill_wheel *self, struct dill_wheel_item *item) {
+    dill_wheel_place(self, item);
+    self->count++;
+}
+
+void dill_wheel_erase(struct dill_wheel *self, struct dill_wheel_item *item) {
+    dill_list_erase(&item->item);
+    self->count--;
+    if(item->level >= 0 && item->level < DILL_WHEEL_LEVELS &&
+          dill_list_empty(&self->slots[item->level][item->slot]))
+        self->bitmaps[item->level] &= ~(((uint64_t)1) << item->slot);
+}
+
+/* Moves all the items from the list back into the wheel. Relative order of
+   the items is preserved. */
+static void dill_wheel_replace(struct dill_wheel *self,
+      struct dill_list *lst) {
+    struct dill_list tmp;
+    if(dill_list_empty(lst)) return;
+    /* Move the items to a temporary list first, so that the items that end up
+       in the same list again aren't processed twice. */
+    tmp.next = lst->next;
+    tmp.prev = lst->prev;
+    tmp.next->prev = &tmp;
+    tmp.prev->next = &tmp;
+    dill_list_init(lst);
+    while(!dill_list_empty(&tmp)) {
+        struct dill_wheel_item *item = dill_cont(dill_list_next(&tmp),
+            struct dill_wheel_item, item);
+        dill_list_erase(&item->item);
+        dill_wheel_place(self, item);
+    }
+}
+
+/* If current time is at the beginning of a block, the items from the slot
+   corresponding to the block are moved to the lower levels. Higher levels
+   have to go first as they can move items to the slots on the lower levels
+   that are about to be processed. */
+static void dill_wheel_cascade(struct dill_wheel *self) {
+    int64_t top = dill_wheel_span(DILL_WHEEL_LEVELS);
+    if(dill_slow(!(self->cur & (top - 1))))
+        dill_wheel_replace(self, &self->overflow);
+    int level;
+    for(level = DILL_WHEEL_LEVELS - 1; level > 0; --level) {
+        if(self->cur & (dill_wheel_span(level) - 1)) continue;
+        int slot = (int)((self->cur >> (level * DILL_WHEEL_BITS)) &
+            DILL_WHEEL_MASK);
+        if(!(self->bitmaps[level] & (((uint64_t)1) << slot))) continue;
+        self->bitmaps[level] &= ~(((uint64_t)1) << slot);
+        dill_wheel_replace(self, &self->slots[level][slot]);
+    }
+}
+
+int64_t dill_wheel_next(struct dill_wheel *self) {
+    if(!self->count) return -1;
+    if(!dill_list_empty(&self->expired)) return self->cur - 1;
+    int level;
+    for(level = 0; level != DILL_WHEEL_LEVELS; ++level) {
+        int shift = level * DILL_WHEEL_BITS;
+        int slot = (int)((self->cur >> shift) & DILL_WHEEL_MASK);
+        /* On level 0 the current slot counts. On higher levels the current
+           slot was already moved to the lower levels. */
+        uint64_t bits = self->bitmaps[level];
+        if(level == 0)
+            bits &= ~((uint64_t)0) << slot;
+        else
+            bits &= slot == DILL_WHEEL_MASK ? 0 : ~((uint64_t)0) << (slot + 1);
+        if(!bits) continue;
+        /* Beginning of the first non-empty slot. */
+        int64_t block = self->cur & ~(dill_wheel_span(level + 1) - 1);
+        return block + (((int64_t)__builtin_ctzll(bits)) << shift);
+    }
+    /* Only overflow items are left. Wake up when the topmost level wraps. */
+    int64_t top = dill_wheel_span(DILL_WHEEL_LEVELS);
+    return (self->cur & ~(top - 1)) + top;
+}
+
+struct dill_wheel_item *dill_wheel_top(struct dill_wheel *self, int64_t now) {
+    if(dill_slow(!dill_list_empty(&self->expired)))
+        return dill_cont(dill_list_next(&self->expired),
+            struct dill_wheel_item, item);
+    while(self->cur <= now) {
+        struct dill_list *slot = &self->slots[0][self->cur & DILL_WHEEL_MASK];
+        if(!dill_list_empty(slot))
+            return dill_cont(dill_list_next(slot), struct dill_wheel_item,
+                item);
+        /* Skip directly to the next interesting point in time. There's nothing
+           to move to the lower levels in between. */
+        int64_t next = dill_wheel_next(self);
+        self->cur = next < 0 || next > now ? now + 1 : next;
+        dill_wheel_cascade(self);
+    }
+    return NULL;
+}
+
@@ -0,0 +1,92 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef DILL_WHEEL_INCLUDED
+#define DILL_WHEEL_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/* Hierarchical timing wheel with millisecond resolution. Adding and erasing
+   an item are O(1). Items are moved from higher levels to the lower ones
+   lazily, when the wheel is advanced by dill_wheel_top(). Items with equal
+   values are returned in the order they were added to the wheel.
+
+   Each level has 64 slots. Level 0 slots are individual milliseconds within
+   the current 64ms block, level 1 slots are 64ms blocks within the current
+   4096ms block and so on. An item is placed on the lowest level where its
+   deadline shares the block with the current time of the wheel. Items beyond
+   the range of the topmost level are kept in an unordered overflow list.
+   Items with deadlines that have already passed are kept in a separate list
+   so that they expire immediately. */
+
+#define DILL_WHEEL_BITS 6
+#define DILL_WHEEL_SLOTS (1 << DILL_WHEEL_BITS)
+#define DILL_WHEEL_LEVELS 6
+
+struct dill_wheel_item {
+    /* The deadline, in milliseconds. Set it before adding the item. */
+    int64_t val;
+    /* Position of the item in the wheel. Level -1 means the expired list,
+       level DILL_WHEEL_LEVELS means the overflow list. */
+    struct dill_list item;
+    int level;
+    int slot;
+};
+
+struct dill_wheel {
+    /* All the ticks before this point in time were already processed. */
+    int64_t cur;
+    size_t count;
+    /* Bit N is set if slot N on the respective level is not empty. */
+    uint64_t bitmaps[DILL_WHEEL_LEVELS];
+    struct dill_list slots[DILL_WHEEL_LEVELS][DILL_WHEEL_SLOTS];
+    struct dill_list overflow;
+    struct dill_list expired;
+};
+
+void dill_wheel_init(struct dill_wheel *self, int64_t now);
+void dill_wheel_term(struct dill_wheel *self);
+
+/* True if the wheel has no items. */
+static inline int dill_wheel_empty(struct dill_wheel *self) {
+    return !self->count;
+}
+
+void dill_wheel_add(struct dill_wheel *self, struct dill_wheel_item *item);
+void dill_wheel_erase(struct dill_wheel *self, struct dill_wheel_item *item);
+
+/* Returns the earliest point in time when the wheel has to be advanced.
+   That may be either an expiry of an item or the moment when items have
+   to be moved to a lower level. Returns -1 if the wheel is empty. */
+int64_t dill_wheel_next(struct dill_wheel *self);
+
+/* Advances the wheel up to 'now' and returns the first expired item without
+   removing it from the wheel. Returns NULL if there are no expired items. */
+struct dill_wheel_item *dill_wheel_top(struct dill_wheel *self, int64_t now);
+
+#endif
+